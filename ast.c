@@ -4,14 +4,250 @@
 #include "ast.h"
 
 static long nextnodeID = 1;
+static long nodecount = 0;
 
 long getnid() {
     return nextnodeID++;
 }
+
+long getnodecount() {
+    return nodecount;
+}
 void resetNid() {
     nextnodeID = 1;
 }
 
+/* Next node id, to continue numbering in a resumed run */
+long peeknid() {
+    return nextnodeID;
+}
+
+void setnid(long next) {
+    nextnodeID = next;
+}
+
+void initframes(FrameStack* stack, size_t size) {
+    stack->frames = NULL;
+    stack->size = size;
+    stack->count = 0;
+    stack->capacity = 0;
+}
+
+/* Push a zeroed frame; pointers to earlier frames are invalidated */
+void* pushframe(FrameStack* stack) {
+    if (stack->count == stack->capacity) {
+        int capacity = stack->capacity ? stack->capacity * 2 : 64;
+        char* frames = realloc(stack->frames, capacity * stack->size);
+        switch (frames != NULL) {
+            case 0:
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+        }
+        stack->frames = frames;
+        stack->capacity = capacity;
+    }
+    void* frame = stack->frames + stack->count * stack->size;
+    memset(frame, 0, stack->size);
+    stack->count++;
+    return frame;
+}
+
+void* topframe(FrameStack* stack) {
+    return stack->count > 0 ? stack->frames + (stack->count - 1) * stack->size : NULL;
+}
+
+void popframe(FrameStack* stack) {
+    if (stack->count > 0) stack->count--;
+}
+
+void freeframes(FrameStack* stack) {
+    free(stack->frames);
+    initframes(stack, stack->size);
+}
+
+/* Storage of the tape AST */
+typedef struct TapeChunk {
+    struct TapeChunk* next;
+    size_t used;
+    size_t size;
+    char data[];
+} TapeChunk;
+
+#define TAPE_CHUNK 65536
+
+static FrameStack tapenodes = { NULL, sizeof(TapeNode), 0, 0 };
+static FrameStack tapeslots = { NULL, sizeof(TapeSlot), 0, 0 };
+static FrameStack tapepending = { NULL, sizeof(TapeSlot), 0, 0 };  /* Children of open containers */
+static FrameStack tapemarks = { NULL, sizeof(int), 0, 0 };         /* Pending count at each open container */
+static TapeChunk* tapechunks = NULL;
+static long tapefirstid = 0;
+
+static TapeNode* nodeat(int index) {
+    return (TapeNode*)tapenodes.frames + index;
+}
+
+static TapeSlot* slotat(int index) {
+    return (TapeSlot*)tapeslots.frames + index;
+}
+
+static int ontape(ASTNode* node) {
+    return (((TapeNode*)node)->type & NODE_TAPE) != 0;
+}
+
+/* Copy a string into the arena */
+static char* tapecopy(const char* s) {
+    size_t len = strlen(s) + 1;
+    if (!tapechunks || tapechunks->used + len > tapechunks->size) {
+        size_t size = len > TAPE_CHUNK ? len : TAPE_CHUNK;
+        TapeChunk* chunk = malloc(sizeof(TapeChunk) + size);
+        switch (chunk != NULL) {
+            case 0:
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+        }
+        chunk->next = tapechunks;
+        chunk->used = 0;
+        chunk->size = size;
+        tapechunks = chunk;
+    }
+    char* copy = tapechunks->data + tapechunks->used;
+    memcpy(copy, s, len);
+    tapechunks->used += len;
+    return copy;
+}
+
+static TapeNode* tapepush(NodeType type) {
+    long id = getnid();
+    if (tapenodes.count == 0) tapefirstid = id;
+    TapeNode* node = pushframe(&tapenodes);
+    node->type = type | NODE_TAPE;
+    node->parent = -1;
+    nodecount++;
+    return node;
+}
+
+/* A '{' or '[' was read; its children are collected until tapeclose */
+void tapeopen() {
+    *(int*)pushframe(&tapemarks) = tapepending.count;
+}
+
+/* The value just completed is a child of the innermost open container */
+void tapeslot(const char* key) {
+    TapeSlot* slot = pushframe(&tapepending);
+    slot->key = key ? tapecopy(key) : NULL;
+    slot->node = tapenodes.count - 1;
+}
+
+void tapeclose(NodeType type) {
+    int mark = *(int*)topframe(&tapemarks);
+    popframe(&tapemarks);
+    int index = tapenodes.count;
+    int first = tapeslots.count;
+    int i = mark;
+    while (i < tapepending.count) {
+        TapeSlot* slot = pushframe(&tapeslots);
+        *slot = ((TapeSlot*)tapepending.frames)[i];
+        nodeat(slot->node)->parent = index;
+        i++;
+    }
+    TapeNode* node = tapepush(type);
+    node->value.kids.first = first;
+    node->value.kids.count = tapepending.count - mark;
+    tapepending.count = mark;
+}
+
+void tapestr(const char* value) {
+    tapepush(nodestr)->value.strVal = tapecopy(value);
+}
+
+void tapeint(long value) {
+    tapepush(nodeint)->value.intVal = value;
+}
+
+void tapenum(double value) {
+    tapepush(nodenum)->value.numVal = value;
+}
+
+void tapebool(int value) {
+    tapepush(nodebool)->value.boolVal = value;
+}
+
+void tapenull() {
+    tapepush(nodenull);
+}
+
+/* The node completed last; once parsing is done, the root */
+ASTNode* tapelast() {
+    return tapenodes.count > 0 ? (ASTNode*)nodeat(tapenodes.count - 1) : NULL;
+}
+
+void deletetape() {
+    freeframes(&tapenodes);
+    freeframes(&tapeslots);
+    freeframes(&tapepending);
+    freeframes(&tapemarks);
+    while (tapechunks) {
+        TapeChunk* next = tapechunks->next;
+        free(tapechunks);
+        tapechunks = next;
+    }
+}
+
+NodeType nodetype(ASTNode* node) {
+    return ontape(node) ? (NodeType)(((TapeNode*)node)->type & ~NODE_TAPE) : node->type;
+}
+
+/* Number of pairs of an object or elements of an array */
+int getcount(ASTNode* node) {
+    if (!node) return 0;
+    switch (nodetype(node)) {
+        case nodeobj:
+            return ontape(node) ? ((TapeNode*)node)->value.kids.count : node->value.object.pairCount;
+        case nodearr:
+            return ontape(node) ? ((TapeNode*)node)->value.kids.count : node->value.array.elemCount;
+        default:
+            return 0;
+    }
+}
+
+ASTNode* getchild(ASTNode* node, int i) {
+    if (ontape(node)) {
+        return (ASTNode*)nodeat(slotat(((TapeNode*)node)->value.kids.first + i)->node);
+    }
+    return node->type == nodeobj ? node->value.object.pairs[i]->value : node->value.array.elements[i];
+}
+
+char* getkey(ASTNode* obj, int i) {
+    if (ontape(obj)) {
+        return slotat(((TapeNode*)obj)->value.kids.first + i)->key;
+    }
+    return obj->type == nodeobj ? obj->value.object.pairs[i]->key : NULL;
+}
+
+ASTNode* getparent(ASTNode* node) {
+    if (ontape(node)) {
+        int parent = ((TapeNode*)node)->parent;
+        return parent >= 0 ? (ASTNode*)nodeat(parent) : NULL;
+    }
+    return node->parent;
+}
+
+char* getstr(ASTNode* node) {
+    return ontape(node) ? ((TapeNode*)node)->value.strVal : node->value.strVal;
+}
+
+long getint(ASTNode* node) {
+    return ontape(node) ? ((TapeNode*)node)->value.intVal : node->value.intVal;
+}
+
+double getnum(ASTNode* node) {
+    return ontape(node) ? ((TapeNode*)node)->value.numVal : node->value.numVal;
+}
+
+int getbool(ASTNode* node) {
+    return ontape(node) ? ((TapeNode*)node)->value.boolVal : node->value.boolVal;
+}
+
 ASTNode* objnode(KeyValuePair** pairs, int count) {
     ASTNode* node = calloc(1, sizeof(ASTNode));
     if (!node) return NULL;
@@ -20,6 +256,7 @@ ASTNode* objnode(KeyValuePair** pairs, int count) {
     node->value.object.pairCount = count;
     node->parent = NULL;
     node->node_id = getnid();
+    nodecount++;
     switch (pairs != NULL) {
         case 1: 
             int i = 0;
@@ -53,6 +290,7 @@ ASTNode* arrnode(ASTNode** elements, int count) {
     node->value.array.elemCount = count;
     node->parent = NULL;
     node->node_id = getnid();
+    nodecount++;
     switch (elements != NULL) {
         case 1: {
             int i = 0;
@@ -75,17 +313,25 @@ ASTNode* arrnode(ASTNode** elements, int count) {
 }
 
 ASTNode* strnode(char* value) {
+    char* copy = strdup(value);
+    return copy ? movestrnode(copy) : NULL;
+}
+
+/* A string node that takes ownership of value, which is freed if the node cannot be made */
+ASTNode* movestrnode(char* value) {
     ASTNode* node = calloc(1, sizeof(ASTNode));
     switch (node != NULL) {
         case 0:
+            free(value);
             return NULL;
         default:
             break;
     }
     node->type = nodestr;
-    node->value.strVal = strdup(value);
+    node->value.strVal = value;
     node->parent = NULL;
     node->node_id = getnid();
+    nodecount++;
     return node;
 }
 
@@ -102,6 +348,7 @@ ASTNode* intnode(long value) {
     node->value.intVal = value;
     node->parent = NULL;
     node->node_id = getnid();
+    nodecount++;
     return node;
 }
 
@@ -117,6 +364,7 @@ ASTNode* numnode(double value) {
     node->value.numVal = value;
     node->parent = NULL;
     node->node_id = getnid();
+    nodecount++;
     return node;
 }
 
@@ -133,6 +381,7 @@ ASTNode* boolnode(int value) {
     node->value.boolVal = value;
     node->parent = NULL;
     node->node_id = getnid();
+    nodecount++;
     return node;
 }
 
@@ -148,33 +397,42 @@ ASTNode* nullnode() {
     node->type = nodenull;
     node->parent = NULL;
     node->node_id = getnid();
+    nodecount++;
     return node;
 }
 
 KeyValuePair* createKVpair(char* key, ASTNode* value) {
+    char* copy = strdup(key);
+    return copy ? moveKVpair(copy, value) : NULL;
+}
+
+/* A pair that takes ownership of key, which is freed if the pair cannot be made */
+KeyValuePair* moveKVpair(char* key, ASTNode* value) {
     KeyValuePair* pair = calloc(1, sizeof(KeyValuePair));
     switch (pair != NULL) {
         case 0:
+            free(key);
             return NULL;
         default:
             break;
     }
-    pair->key = strdup(key);
+    pair->key = key;
     pair->value = value;
     return pair;
 }
 
 ASTNode* getbyname(ASTNode* obj, const char* key) {
-    switch (obj && obj->type == nodeobj) {
+    switch (isobj(obj)) {
         case 0:
             return NULL;
         default:
             break;
     }
+    int count = getcount(obj);
     int i = 0;
-    while (i < obj->value.object.pairCount) {
-        if (strcmp(obj->value.object.pairs[i]->key, key) == 0) {
-            return obj->value.object.pairs[i]->value;
+    while (i < count) {
+        if (strcmp(getkey(obj, i), key) == 0) {
+            return getchild(obj, i);
         }
         i++;
     }
@@ -204,105 +462,182 @@ void apptosig(char** sig, size_t* size, size_t* pos, const char* key) {
     (*sig)[*pos] = '\0';
 }
 
-char* getsig(ASTNode* obj) {
-    switch (obj && obj->type == nodeobj) {
-        case 0:
-            return NULL;
+#define SIG_INLINE 16
+
+/* An object whose keys are being appended to a signature */
+typedef struct {
+    ASTNode* obj;
+    int* sorted;            /* Pair indices ordered by key, NULL when they fit in inline */
+    int inline_sorted[SIG_INLINE];
+    int count;              /* Number of pairs */
+    int next;               /* Next pair to append */
+    size_t start;           /* Signature length when the object began */
+} SigFrame;
+
+/* Where a signature goes: a string, or only its hash for getshape */
+typedef struct {
+    char* sig;
+    size_t size;
+    size_t pos;
+    unsigned long hash;
+    int hashing;
+} SigOut;
+
+static void sigput(SigOut* out, const char* token) {
+    if (!out->hashing) {
+        apptosig(&out->sig, &out->size, &out->pos, token);
+        return;
+    }
+    /* FNV-1a over the same bytes apptosig would append, separator included */
+    unsigned long h = out->hash;
+    const char* c = token;
+    while (*c) {
+        h ^= (unsigned char)*c++;
+        h *= 1099511628211UL;
     }
-    size_t size = 256; 
-    size_t pos = 0;
-    char* sig = malloc(size);
-    if (!sig) return NULL;
-    sig[0] = '\0';
-    int count = obj->value.object.pairCount;
-    char** keys = malloc(count * sizeof(char*));
-    if (!keys) {
-        free(sig);
-        return NULL;
+    h ^= (unsigned char)',';
+    h *= 1099511628211UL;
+    out->hash = h;
+    out->pos += (c - token) + 1;
+}
+
+static int* sigorder(SigFrame* frame) {
+    return frame->sorted ? frame->sorted : frame->inline_sorted;
+}
+
+static int pushsig(FrameStack* stack, ASTNode* obj, size_t start) {
+    int count = getcount(obj);
+    SigFrame* frame = pushframe(stack);
+    frame->obj = obj;
+    frame->sorted = NULL;
+    if (count > SIG_INLINE) {
+        frame->sorted = malloc(count * sizeof(int));
+        if (!frame->sorted) return 0;
     }
+    frame->count = count;
+    frame->next = 0;
+    frame->start = start;
+    int* sorted = sigorder(frame);
     int i = 0;
     while (i < count) {
-        keys[i] = obj->value.object.pairs[i]->key;
-        i++;
-    }
-    i = 0;
-    while (i < count - 1) {
-        int j = 0;
-        while (j < count - i - 1) {
-            if (strcmp(keys[j], keys[j+1]) > 0) {
-                char* temp = keys[j];
-                keys[j] = keys[j+1];
-                keys[j+1] = temp;
-            }
-            j++;
+        char* key = getkey(obj, i);
+        int j = i;
+        while (j > 0 && strcmp(getkey(obj, sorted[j-1]), key) > 0) {
+            sorted[j] = sorted[j-1];
+            j--;
         }
+        sorted[j] = i;
         i++;
     }
-    i = 0;
-    while (i < count) {
-        apptosig(&sig, &size, &pos, keys[i]);
-        ASTNode* value = NULL;
-        int j = 0;
-        while (j < count) {
-            if (strcmp(obj->value.object.pairs[j]->key, keys[i]) == 0) {
-                value = obj->value.object.pairs[j]->value;
-                break;
+    return 1;
+}
+
+/* Append the shape of obj: its sorted keys with value types, and the shape of the first element of each array of objects */
+static void walksig(ASTNode* obj, SigOut* out) {
+    FrameStack stack;
+    initframes(&stack, sizeof(SigFrame));
+    if (!pushsig(&stack, obj, out->pos)) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    while (stack.count > 0) {
+        SigFrame* frame = topframe(&stack);
+        if (frame->next >= frame->count) {
+            /* A nested object's signature is followed by a separator even when empty */
+            int nested = stack.count > 1;
+            size_t start = frame->start;
+            free(frame->sorted);
+            popframe(&stack);
+            if (nested && out->pos == start) {
+                sigput(out, "");
             }
-            j++;
+            continue;
+        }
+        int i = frame->next++;
+        ASTNode* cur = frame->obj;
+        int* sorted = sigorder(frame);
+        char* key = getkey(cur, sorted[i]);
+        sigput(out, key);
+        /* Duplicate keys all describe the first occurrence's value */
+        ASTNode* value = getchild(cur, sorted[i]);
+        while (i > 0 && strcmp(getkey(cur, sorted[i-1]), key) == 0) {
+            value = getchild(cur, sorted[--i]);
         }
         if (value) {
-            switch (value->type) {
+            switch (nodetype(value)) {
                 case nodeobj:
-                    apptosig(&sig, &size, &pos, "{}");
+                    sigput(out, "{}");
                     break;
                 case nodearr:
-                    apptosig(&sig, &size, &pos, "[]");
-                    if (value->value.array.elemCount > 0) {
-                        ASTNode* first = value->value.array.elements[0];
-                        switch (first->type) {
-                            case nodeobj: {
-                                char* inner_sig = getsig(first);
-                                if (inner_sig) {
-                                    apptosig(&sig, &size, &pos, inner_sig);
-                                    free(inner_sig);
+                    sigput(out, "[]");
+                    if (getcount(value) > 0) {
+                        ASTNode* first = getchild(value, 0);
+                        switch (nodetype(first)) {
+                            case nodeobj:
+                                if (!pushsig(&stack, first, out->pos)) {
+                                    fprintf(stderr, "Memory allocation failed\n");
+                                    exit(1);
                                 }
                                 break;
-                            }
                             default:
                                 break;
                         }
                     }
                     break;
                 case nodestr:
-                    apptosig(&sig, &size, &pos, "s");
+                    sigput(out, "s");
                     break;
                 case nodeint:
-                    apptosig(&sig, &size, &pos, "i");
+                    sigput(out, "i");
                     break;
                 case nodenum:
-                    apptosig(&sig, &size, &pos, "n");
+                    sigput(out, "n");
                     break;
                 case nodebool:
-                    apptosig(&sig, &size, &pos, "b");
+                    sigput(out, "b");
                     break;
                 case nodenull:
-                    apptosig(&sig, &size, &pos, "0");
+                    sigput(out, "0");
                     break;
                 default:
                     break;
             }
         }
-        i++;
     }
-    free(keys);
-    if (pos > 0 && sig[pos - 1] == ',') {
-        sig[pos - 1] = '\0';
+    freeframes(&stack);
+}
+
+char* getsig(ASTNode* obj) {
+    switch (isobj(obj)) {
+        case 0:
+            return NULL;
     }
-    return sig;
+    SigOut out = { malloc(256), 256, 0, 0, 0 };
+    if (!out.sig) return NULL;
+    out.sig[0] = '\0';
+    walksig(obj, &out);
+    if (out.pos > 0 && out.sig[out.pos - 1] == ',') {
+        out.sig[out.pos - 1] = '\0';
+    }
+    return out.sig;
+}
+
+/* Hash of an object's signature without building it; equals sigshape(getsig(obj)) */
+unsigned long getshape(ASTNode* obj) {
+    if (!isobj(obj)) return 0;
+    SigOut out = { NULL, 0, 0, 1469598103934665603UL, 1 };
+    walksig(obj, &out);
+    return out.hash;
+}
+
+unsigned long sigshape(const char* signature) {
+    SigOut out = { NULL, 0, 0, 1469598103934665603UL, 1 };
+    if (*signature) sigput(&out, signature);
+    return out.hash;
 }
 
 int matches(ASTNode* obj, const char* signature) {
-    if (!obj || obj->type != nodeobj || !signature) return 0;
+    if (!isobj(obj) || !signature) return 0;
     
     char* obj_sig = getsig(obj);
     if (!obj_sig) return 0;
@@ -313,138 +648,360 @@ int matches(ASTNode* obj, const char* signature) {
     return result;
 }
 
+static unsigned long mixhash(unsigned long h, unsigned long v) {
+    h ^= v + 0x9e3779b97f4a7c15UL + (h << 6) + (h >> 2);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    return h;
+}
+
+static unsigned long hashtext(unsigned long seed, const char* s) {
+    unsigned long h = 1469598103934665603UL ^ seed;
+    for (; s && *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+/*
+ * Set the hash of a just completed node from its value, or from the keys
+ * and hashes of its children, so equal subtrees get equal hashes.
+ */
+void merkle(ASTNode* node) {
+    if (!node || ontape(node)) return;
+    unsigned long h = mixhash(0, node->type + 1);
+    switch (node->type) {
+        case nodeobj:
+            for (int i = 0; i < node->value.object.pairCount; i++) {
+                KeyValuePair* pair = node->value.object.pairs[i];
+                h = mixhash(h, hashtext(0, pair->key));
+                h = mixhash(h, pair->value ? pair->value->hash : 0);
+            }
+            break;
+        case nodearr:
+            for (int i = 0; i < node->value.array.elemCount; i++) {
+                ASTNode* elem = node->value.array.elements[i];
+                h = mixhash(h, elem ? elem->hash : 0);
+            }
+            break;
+        case nodestr:
+            h = mixhash(h, hashtext(1, node->value.strVal));
+            break;
+        case nodeint:
+            h = mixhash(h, (unsigned long)node->value.intVal);
+            break;
+        case nodenum: {
+            unsigned long bits;
+            memcpy(&bits, &node->value.numVal, sizeof(bits));
+            h = mixhash(h, bits);
+            break;
+        }
+        case nodebool:
+            h = mixhash(h, node->value.boolVal != 0);
+            break;
+        default:
+            break;
+    }
+    node->hash = h;
+}
+
+unsigned long gethash(ASTNode* node) {
+    return node && !ontape(node) ? node->hash : 0;
+}
+
+/* Text being built by subtreekey, or compared against one by subtreeis */
+typedef struct {
+    char* text;
+    size_t size;
+    size_t pos;
+    const char* expect;     /* Encoding to compare against instead of building one */
+    int differs;
+} KeyOut;
+
+static void keyput(KeyOut* out, const char* bytes, size_t len) {
+    if (out->expect) {
+        if (!out->differs && strncmp(out->expect + out->pos, bytes, len) != 0) out->differs = 1;
+        out->pos += len;
+        return;
+    }
+    while (out->pos + len + 1 > out->size) {
+        out->size *= 2;
+        out->text = realloc(out->text, out->size);
+        switch (out->text != NULL) {
+            case 0:
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+        }
+    }
+    memcpy(out->text + out->pos, bytes, len);
+    out->pos += len;
+    out->text[out->pos] = '\0';
+}
+
+/* Append a tagged, length-prefixed string, so no two subtrees encode alike */
+static void keystr(KeyOut* out, char tag, const char* s) {
+    char head[32];
+    size_t len = strlen(s);
+    keyput(out, head, snprintf(head, sizeof(head), "%c%zu:", tag, len));
+    keyput(out, s, len);
+}
+
+/* A subtree being encoded by subtreekey, and its next child */
+typedef struct {
+    ASTNode* node;
+    int next;
+} KeyFrame;
+
+/* Encode a subtree, stopping early once it differs from the expected encoding */
+static void encodesubtree(ASTNode* node, KeyOut* out) {
+    char head[32];
+    keyput(out, head, snprintf(head, sizeof(head), "%016lx", gethash(node)));
+    FrameStack stack;
+    initframes(&stack, sizeof(KeyFrame));
+    KeyFrame* frame = pushframe(&stack);
+    frame->node = node;
+    frame->next = -1;
+    while (stack.count > 0 && !out->differs) {
+        frame = topframe(&stack);
+        ASTNode* cur = frame->node;
+        if (!cur) {
+            keyput(out, "z", 1);
+            popframe(&stack);
+            continue;
+        }
+        if (frame->next < 0) {
+            frame->next = 0;
+            unsigned long bits;
+            switch (cur->type) {
+                case nodeobj:
+                    keyput(out, "{", 1);
+                    continue;
+                case nodearr:
+                    keyput(out, "[", 1);
+                    continue;
+                case nodestr:
+                    keystr(out, 's', cur->value.strVal);
+                    break;
+                case nodeint:
+                    keyput(out, head, snprintf(head, sizeof(head), "i%ld;", cur->value.intVal));
+                    break;
+                case nodenum:
+                    memcpy(&bits, &cur->value.numVal, sizeof(bits));
+                    keyput(out, head, snprintf(head, sizeof(head), "n%016lx", bits));
+                    break;
+                case nodebool:
+                    keyput(out, cur->value.boolVal ? "t" : "f", 1);
+                    break;
+                default:
+                    keyput(out, "z", 1);
+                    break;
+            }
+            popframe(&stack);
+            continue;
+        }
+        int obj = cur->type == nodeobj;
+        if (frame->next >= getcount(cur)) {
+            keyput(out, obj ? "}" : "]", 1);
+            popframe(&stack);
+            continue;
+        }
+        int i = frame->next++;
+        if (obj) keystr(out, 'k', getkey(cur, i));
+        ASTNode* child = getchild(cur, i);
+        frame = pushframe(&stack);
+        frame->node = child;
+        frame->next = -1;
+    }
+    freeframes(&stack);
+}
+
+/*
+ * Key of a subtree for --dedup-subtrees: its hash followed by an exact
+ * encoding of its keys and values, so that subtrees with equal keys are
+ * equal and not merely of equal hash. The caller frees it.
+ */
+char* subtreekey(ASTNode* node) {
+    KeyOut out = { malloc(256), 256, 0, NULL, 0 };
+    switch (out.text != NULL) {
+        case 0:
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+    }
+    encodesubtree(node, &out);
+    return out.text;
+}
+
+/* Whether a subtree has the key subtreekey() gave, compared without building its own */
+int subtreeis(ASTNode* node, const char* key) {
+    KeyOut out = { NULL, 0, 0, key, 0 };
+    encodesubtree(node, &out);
+    return !out.differs && key[out.pos] == '\0';
+}
+
 long getnodeID(ASTNode* node) {
-    return node ? node->node_id : 0;
+    if (!node) return 0;
+    return ontape(node) ? tapefirstid + ((TapeNode*)node - nodeat(0)) : node->node_id;
 }
 
 int isobj(ASTNode* node) {
-    return node && node->type == nodeobj;
+    return node && nodetype(node) == nodeobj;
 }
 
 int isArray(ASTNode* node) {
-    return node && node->type == nodearr;
+    return node && nodetype(node) == nodearr;
 }
 
 int scalar(ASTNode* node) {
     if (!node) return 0;
-    return node->type != nodeobj && node->type != nodearr;
+    return nodetype(node) != nodeobj && nodetype(node) != nodearr;
 }
 
-void printnodeast(ASTNode* node, int indent, char* prefix) {
-    if (!node) return;
-    char indent_str[256] = {0};
-    char tree_prefix[256] = {0};
-    switch(prefix != NULL) {
-        case 1:
-            strcpy(tree_prefix, prefix);
-            break;
-        case 0:
-            break;
+/* Discard the node completed last, a leaf, and give back its id; NULL drops the tape's */
+void dropnode(ASTNode* node) {
+    if (node) {
+        deleteast(node);
+    } else if (tapenodes.count > 0) {
+        tapenodes.count--;
     }
-    for (int i = 0; i < indent; i++) {
-        if (i == indent - 1) {
-            strcat(tree_prefix, "└── ");
-        } else {
-            strcat(tree_prefix, "    ");
+    nextnodeID--;
+    nodecount--;
+}
+
+void markast(ASTMark* mark) {
+    mark->nid = nextnodeID;
+    mark->nodes = nodecount;
+    mark->tapenodes = tapenodes.count;
+    mark->tapeslots = tapeslots.count;
+    mark->chunk = tapechunks;
+    mark->used = tapechunks ? tapechunks->used : 0;
+}
+
+/* Give back the node ids and counts taken since mark, for nodes already freed */
+void rewindids(ASTMark* mark) {
+    nextnodeID = mark->nid;
+    nodecount = mark->nodes;
+}
+
+/* Discard everything created since mark: the tree rooted at node, or the tape's tail when NULL */
+void rewindast(ASTMark* mark, ASTNode* node) {
+    if (node) {
+        deleteast(node);
+    } else {
+        tapenodes.count = mark->tapenodes;
+        tapeslots.count = mark->tapeslots;
+        while (tapechunks && tapechunks != mark->chunk) {
+            TapeChunk* next = tapechunks->next;
+            free(tapechunks);
+            tapechunks = next;
         }
+        if (tapechunks) tapechunks->used = mark->used;
     }
+    rewindids(mark);
+}
+
+/* A container whose children are being printed */
+typedef struct {
+    ASTNode* node;
+    int indent;
+    int next;       /* Next pair or element to print */
+} PrintFrame;
+
+static void printspaces(int indent) {
     for (int i = 0; i < indent * 4; i++) {
-        indent_str[i] = ' ';
+        putchar(' ');
     }
-    switch(node->type) {
-        case nodeobj:
-            printf("%sObject (id=%ld) {\n", tree_prefix, node->node_id);
-            
-            int i = 0;
-            while (i < node->value.object.pairCount) {
-                KeyValuePair* pair = node->value.object.pairs[i];
-                char child_prefix[256] = {0};
-                strcpy(child_prefix, indent_str);
-                switch(i == node->value.object.pairCount - 1) {
-                    case 1:
-                        strcat(child_prefix, "└── ");
-                        break;
-                    default:
-                        strcat(child_prefix, "├── ");
-                        break;
-                }
-                printf("%s\"%s\": ", child_prefix, pair->key);
-                if (scalar(pair->value)) {
-                    printnodeast(pair->value, 0, NULL);
-                    printf("\n");
-                } else {
-                    printf("\n");
-                    char nested_prefix[256] = {0};
-                    strcpy(nested_prefix, indent_str);
-                    switch(i == node->value.object.pairCount - 1) {
-                        case 1:
-                            strcat(nested_prefix, "    ");
-                            break;
-                        default:
-                            strcat(nested_prefix, "│   ");
-                            break;
-                    }
-                    printnodeast(pair->value, 1, nested_prefix);
-                }
-                i++;
-            }
-            if (indent > 0) {
-                printf("%s}\n", indent_str);
-            } else if (prefix) {
-                printf("%s}\n", prefix);
-            } else {
-                printf("}\n");
-            }
-            break;
-        case nodearr:
-            printf("%sArray (id=%ld) [\n", tree_prefix, node->node_id);
-            int j = 0;
-            while (j < node->value.array.elemCount) {
-                char child_prefix[256] = {0};
-                strcpy(child_prefix, indent_str);
-                switch(j == node->value.array.elemCount - 1) {
-                    case 1:
-                        printf("%s└── [%d]: ", indent_str, j);
-                        strcat(child_prefix, "    ");
-                        break;
-                    default:
-                        printf("%s├── [%d]: ", indent_str, j);
-                        strcat(child_prefix, "│   ");
-                        break;
-                }
-                if (scalar(node->value.array.elements[j])) {
-                    printnodeast(node->value.array.elements[j], 0, NULL);
-                    printf("\n");
-                } else {
-                    printf("\n");
-                    printnodeast(node->value.array.elements[j], 1, child_prefix);
-                }
-                j++;
-            } 
-            if (indent > 0) {
-                printf("%s]\n", indent_str);
-            } else if (prefix) {
-                printf("%s]\n", prefix);
-            } else {
-                printf("]\n");
-            }
-            break;
+}
+
+static void printscalar(ASTNode* node) {
+    switch(nodetype(node)) {
         case nodestr:
-            printf("%s\"%s\"", tree_prefix, node->value.strVal);
+            printf("\"%s\"", getstr(node));
             break;
         case nodeint:
-            printf("%s%ld", tree_prefix, node->value.intVal);
+            printf("%ld", getint(node));
             break;
         case nodenum:
-            printf("%s%f", tree_prefix, node->value.numVal);
+            printf("%f", getnum(node));
             break;
         case nodebool:
-            printf("%s%s", tree_prefix, node->value.boolVal ? "true" : "false");
+            printf("%s", getbool(node) ? "true" : "false");
             break;
         case nodenull:
-            printf("%snull", tree_prefix);
+            printf("null");
+            break;
+        default:
+            break;
+    }
+}
+
+/* Print a node's first line; containers get a frame for their children */
+static void printopen(FrameStack* stack, ASTNode* node, int indent, const char* prefix) {
+    if (prefix) printf("%s", prefix);
+    for (int i = 0; i < indent; i++) {
+        printf("%s", i == indent - 1 ? "└── " : "    ");
+    }
+    switch(nodetype(node)) {
+        case nodeobj:
+            printf("Object (id=%ld) {\n", getnodeID(node));
+            break;
+        case nodearr:
+            printf("Array (id=%ld) [\n", getnodeID(node));
             break;
+        default:
+            printscalar(node);
+            return;
+    }
+    PrintFrame* frame = pushframe(stack);
+    frame->node = node;
+    frame->indent = indent;
+}
+
+void printnodeast(ASTNode* node, int indent, char* prefix) {
+    if (!node) return;
+    FrameStack stack;
+    initframes(&stack, sizeof(PrintFrame));
+    printopen(&stack, node, indent, prefix);
+    while (stack.count > 0) {
+        PrintFrame* frame = topframe(&stack);
+        ASTNode* cur = frame->node;
+        int isobject = isobj(cur);
+        int count = getcount(cur);
+        int depth = frame->indent;
+        if (frame->next >= count) {
+            if (depth > 0) {
+                printspaces(depth);
+            } else if (prefix) {
+                printf("%s", prefix);
+            }
+            printf(isobject ? "}\n" : "]\n");
+            popframe(&stack);
+            continue;
+        }
+        int i = frame->next++;
+        int last = (i == count - 1);
+        ASTNode* child;
+        printspaces(depth);
+        if (isobject) {
+            printf("%s\"%s\": ", last ? "└── " : "├── ", getkey(cur, i));
+        } else {
+            printf("%s[%d]: ", last ? "└── " : "├── ", i);
+        }
+        child = getchild(cur, i);
+        if (scalar(child)) {
+            printscalar(child);
+            printf("\n");
+        } else {
+            printf("\n");
+            if (child) {
+                printspaces(depth);
+                printf("%s", last ? "    " : "│   ");
+                printopen(&stack, child, 1, NULL);
+            }
+        }
     }
+    freeframes(&stack);
 }
 
 void printast(ASTNode* node, int indent) {
@@ -454,43 +1011,58 @@ void printast(ASTNode* node, int indent) {
 
 void deleteast(ASTNode* node) {
     if (!node) return; 
-    switch(node->type) {
-        case nodeobj:
-            if (node->value.object.pairs) {
-                int i = 0;
-                while (i < node->value.object.pairCount) {
-                    if (node->value.object.pairs[i]) {
-                        if (node->value.object.pairs[i]->key) {
-                            free(node->value.object.pairs[i]->key);
+    if (ontape(node)) {
+        deletetape();
+        return;
+    }
+    FrameStack stack;
+    initframes(&stack, sizeof(ASTNode*));
+    *(ASTNode**)pushframe(&stack) = node;
+    while (stack.count > 0) {
+        node = *(ASTNode**)topframe(&stack);
+        popframe(&stack);
+        switch(node->type) {
+            case nodeobj:
+                if (node->value.object.pairs) {
+                    int i = 0;
+                    while (i < node->value.object.pairCount) {
+                        if (node->value.object.pairs[i]) {
+                            if (node->value.object.pairs[i]->key) {
+                                free(node->value.object.pairs[i]->key);
+                            }
+                            if (node->value.object.pairs[i]->value) {
+                                *(ASTNode**)pushframe(&stack) = node->value.object.pairs[i]->value;
+                            }
+                            free(node->value.object.pairs[i]);
                         }
-                        deleteast(node->value.object.pairs[i]->value);
-                        free(node->value.object.pairs[i]);
+                        i++;
                     }
-                    i++;
+                    free(node->value.object.pairs);
                 }
-                free(node->value.object.pairs);
-            }
-            break;    
-        case nodearr:
-            if (node->value.array.elements) {
-                int i = 0;
-                while (i < node->value.array.elemCount) {
-                    deleteast(node->value.array.elements[i]);
-                    i++;
+                break;    
+            case nodearr:
+                if (node->value.array.elements) {
+                    int i = 0;
+                    while (i < node->value.array.elemCount) {
+                        if (node->value.array.elements[i]) {
+                            *(ASTNode**)pushframe(&stack) = node->value.array.elements[i];
+                        }
+                        i++;
+                    }
+                    free(node->value.array.elements);
                 }
-                free(node->value.array.elements);
-            }
-            break;
-            
-        case nodestr:
-            if (node->value.strVal) {
-                free(node->value.strVal);
-            }
-            break;
-            
-        default:
-            break;
-    } 
-    free(node);
+                break;
+                
+            case nodestr:
+                if (node->value.strVal) {
+                    free(node->value.strVal);
+                }
+                break;
+                
+            default:
+                break;
+        } 
+        free(node);
+    }
+    freeframes(&stack);
 }
-
@@ -37,11 +37,90 @@ struct ASTNode {
     } value;
     ASTNode* parent;
     long node_id;
+    unsigned long hash;     /* Merkle hash of the subtree, set with --dedup-subtrees */
 };
 
+/*
+ * Flat (tape) form of the AST, selected with --tape. Nodes are stored in one
+ * contiguous array in the order they are completed, so children come before
+ * their parent and a node's id is its position plus the id of the first node.
+ * The children of a container are a contiguous run of slots, each holding the
+ * child's key (objects only) and tape index; keys and strings live in a chunked
+ * arena. Tape nodes are handed out as ASTNode* and told apart from tree nodes
+ * by the NODE_TAPE tag in their first field, so the accessors below work on
+ * either form.
+ */
+#define NODE_TAPE 0x100
+
+typedef struct {
+    int type;           /* NodeType | NODE_TAPE */
+    int parent;         /* Tape index of the parent, -1 for the root */
+    union {
+        struct {
+            int first;  /* First slot of the children */
+            int count;  /* Number of children */
+        } kids;
+        char* strVal;
+        long intVal;
+        double numVal;
+        int boolVal;
+    } value;
+} TapeNode;
+
+typedef struct {
+    char* key;          /* Key in the parent object, NULL in arrays */
+    int node;           /* Tape index of the child */
+} TapeSlot;
+
+/* Point in node creation to which a just completed record can be rolled back */
+typedef struct {
+    long nid;           /* Next node id */
+    long nodes;         /* Nodes created */
+    int tapenodes;      /* Tape nodes in use */
+    int tapeslots;      /* Tape slots in use */
+    void* chunk;        /* Arena chunk in use */
+    size_t used;        /* Bytes used in that chunk */
+} ASTMark;
+
+/* Growable stack of fixed-size frames used by the iterative traversals */
+typedef struct {
+    char* frames;       /* Frame storage */
+    size_t size;        /* Bytes per frame */
+    int count;          /* Frames in use */
+    int capacity;       /* Frames allocated */
+} FrameStack;
+
+void initframes(FrameStack* stack, size_t size);
+void* pushframe(FrameStack* stack);
+void* topframe(FrameStack* stack);
+void popframe(FrameStack* stack);
+void freeframes(FrameStack* stack);
+
+void tapeopen();
+void tapeslot(const char* key);
+void tapeclose(NodeType type);
+void tapestr(const char* value);
+void tapeint(long value);
+void tapenum(double value);
+void tapebool(int value);
+void tapenull();
+ASTNode* tapelast();
+void deletetape();
+
+NodeType nodetype(ASTNode* node);
+int getcount(ASTNode* node);
+ASTNode* getchild(ASTNode* node, int i);
+char* getkey(ASTNode* obj, int i);
+ASTNode* getparent(ASTNode* node);
+char* getstr(ASTNode* node);
+long getint(ASTNode* node);
+double getnum(ASTNode* node);
+int getbool(ASTNode* node);
+
 ASTNode* objnode(KeyValuePair** pairs, int count);
 ASTNode* arrnode(ASTNode** elements, int count);
 ASTNode* strnode(char* value);
+ASTNode* movestrnode(char* value);
 ASTNode* intnode(long value);
 ASTNode* numnode(double value);
 ASTNode* boolnode(int value);
@@ -50,12 +129,26 @@ int isobj(ASTNode* node);
 int isArray(ASTNode* node);
 int scalar(ASTNode* node);
 KeyValuePair* createKVpair(char* key, ASTNode* value);
+KeyValuePair* moveKVpair(char* key, ASTNode* value);
 void printnodeast(ASTNode* node, int indent, char* prefix);
 void printast(ASTNode* node, int indent);
 void deleteast(ASTNode* node);
+void dropnode(ASTNode* node);
+void markast(ASTMark* mark);
+void rewindast(ASTMark* mark, ASTNode* node);
+void rewindids(ASTMark* mark);
 ASTNode* getbyname(ASTNode* obj, const char* key);
 char* getsig(ASTNode* obj);
+unsigned long getshape(ASTNode* obj);
+unsigned long sigshape(const char* signature);
 long getnodeID(ASTNode* node);
+void merkle(ASTNode* node);
+unsigned long gethash(ASTNode* node);
+char* subtreekey(ASTNode* node);
+int subtreeis(ASTNode* node, const char* key);
 long getnid();
+long peeknid();
+void setnid(long next);
+long getnodecount();
 int matches(ASTNode* obj, const char* signature);
 #endif 
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/*
+ * End-to-end benchmark harness. Generates every corpus with jsongen, runs
+ * json2relcsv over it and records throughput, peak RSS, the rows written and
+ * the per-phase times reported by --stats=json.
+ *
+ *   bench [--bin PATH] [--gen PATH] [--dir DIR] [--out FILE] [--scale N] [--runs N]
+ *
+ * Results go to --out as JSON (one result object per line). The previous
+ * results file is kept as FILE.prev and the MB/s delta against it is printed.
+ */
+
+typedef struct {
+    const char* kind;   /* jsongen corpus kind */
+    long count;         /* jsongen count at scale 1 */
+} Corpus;
+
+static const Corpus corpora[] = {
+    { "wide",    2000 },
+    { "deep",    1500 },
+    { "array",   50000 },
+    { "scalars", 20000 },
+    { "escapes", 20000 },
+    { "numbers", 30000 },
+};
+
+#define CORPUS_COUNT ((int)(sizeof(corpora) / sizeof(corpora[0])))
+
+typedef struct {
+    long bytes;
+    double wall;
+    double user;
+    double sys;
+    long peak_rss_kb;
+    long records;
+    double phase[3];    /* parse, schema and csv wall seconds */
+    int status;
+} Result;
+
+static const char* phasenames[3] = { "parse", "schema", "csv" };
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double tvsec(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static long filesize(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+/* Count CSV records (quoted newlines do not end a record), minus the header. */
+static long countrows(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) return 0;
+    long lines = 0;
+    int quoted = 0;
+    int c;
+    while ((c = getc(fp)) != EOF) {
+        if (c == '"') quoted = !quoted;
+        else if (c == '\n' && !quoted) lines++;
+    }
+    fclose(fp);
+    return lines > 0 ? lines - 1 : 0;
+}
+
+/* Sum the records of every table in dir and remove the files afterwards. */
+static long collectrows(const char* dir) {
+    DIR* d = opendir(dir);
+    if (!d) return 0;
+    long rows = 0;
+    struct dirent* ent;
+    char path[2048];
+    while ((ent = readdir(d)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        if (len < 5 || strcmp(ent->d_name + len - 4, ".csv") != 0) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        rows += countrows(path);
+        unlink(path);
+    }
+    closedir(d);
+    return rows;
+}
+
+static int gencorpus(const char* gen, const Corpus* corpus, long scale, const char* path) {
+    char cmd[2048];
+    snprintf(cmd, sizeof(cmd), "%s %s %ld > %s", gen, corpus->kind, corpus->count * scale, path);
+    return system(cmd);
+}
+
+/* Pull the per-phase wall times out of a --stats=json report. */
+static void readphases(const char* statspath, Result* res) {
+    FILE* fp = fopen(statspath, "r");
+    if (!fp) return;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        for (int i = 0; i < 3; i++) {
+            char needle[64];
+            snprintf(needle, sizeof(needle), "\"name\": \"%s\", \"wall_s\": ", phasenames[i]);
+            char* p = strstr(line, needle);
+            if (p) res->phase[i] = atof(p + strlen(needle));
+        }
+    }
+    fclose(fp);
+}
+
+static int runone(const char* bin, const char* input, const char* outdir, Result* res) {
+    char statspath[2048];
+    snprintf(statspath, sizeof(statspath), "%s/stats.json", outdir);
+    memset(res, 0, sizeof(*res));
+    res->bytes = filesize(input);
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        int in = open(input, O_RDONLY);
+        int null = open("/dev/null", O_WRONLY);
+        if (in < 0 || null < 0) _exit(127);
+        dup2(in, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execl(bin, bin, "--out-dir", outdir, "--stats=json", "--stats-file", statspath, (char*)NULL);
+        _exit(127);
+    }
+
+    struct rusage ru;
+    int status = 0;
+    if (wait4(pid, &status, 0, &ru) < 0) {
+        perror("wait4");
+        return -1;
+    }
+    res->wall = now() - start;
+    res->user = tvsec(ru.ru_utime);
+    res->sys = tvsec(ru.ru_stime);
+    res->peak_rss_kb = ru.ru_maxrss;
+    res->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    res->records = collectrows(outdir);
+    readphases(statspath, res);
+    unlink(statspath);
+    return 0;
+}
+
+/* Look up a corpus' MB/s in a previous results file written by this harness. */
+static double prevmbps(const char* prevpath, const char* kind) {
+    FILE* fp = fopen(prevpath, "r");
+    if (!fp) return -1;
+    char line[1024];
+    char needle[64];
+    double mbps = -1;
+    snprintf(needle, sizeof(needle), "\"corpus\": \"%s\"", kind);
+    while (fgets(line, sizeof(line), fp)) {
+        if (!strstr(line, needle)) continue;
+        char* p = strstr(line, "\"mb_per_s\": ");
+        if (p) mbps = atof(p + strlen("\"mb_per_s\": "));
+        break;
+    }
+    fclose(fp);
+    return mbps;
+}
+
+int main(int argc, char** argv) {
+    const char* bin = "./json2relcsv";
+    const char* gen = "./bench/jsongen";
+    const char* dir = "bench/corpora";
+    const char* out = "bench/results.json";
+    long scale = 1;
+    int runs = 3;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--bin") && i + 1 < argc) bin = argv[++i];
+        else if (!strcmp(argv[i], "--gen") && i + 1 < argc) gen = argv[++i];
+        else if (!strcmp(argv[i], "--dir") && i + 1 < argc) dir = argv[++i];
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc) out = argv[++i];
+        else if (!strcmp(argv[i], "--scale") && i + 1 < argc) scale = atol(argv[++i]);
+        else if (!strcmp(argv[i], "--runs") && i + 1 < argc) runs = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "Usage: %s [--bin PATH] [--gen PATH] [--dir DIR] [--out FILE] [--scale N] [--runs N]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (scale < 1) scale = 1;
+    if (runs < 1) runs = 1;
+
+    char outdir[1024];
+    snprintf(outdir, sizeof(outdir), "%s/out", dir);
+    mkdir(dir, 0755);
+    mkdir(outdir, 0755);
+
+    char prevpath[1024];
+    snprintf(prevpath, sizeof(prevpath), "%s.prev", out);
+    rename(out, prevpath);
+
+    FILE* res_fp = fopen(out, "w");
+    if (!res_fp) {
+        perror(out);
+        return 1;
+    }
+    fprintf(res_fp, "{\"scale\": %ld, \"runs\": %d, \"results\": [\n", scale, runs);
+
+    printf("%-8s %10s %8s %9s %11s %10s %8s %8s %8s %8s\n",
+           "corpus", "bytes", "wall s", "MB/s", "records/s", "rss KB",
+           "parse s", "schema s", "csv s", "vs prev");
+    int failed = 0;
+    for (int c = 0; c < CORPUS_COUNT; c++) {
+        const Corpus* corpus = &corpora[c];
+        char input[1024];
+        snprintf(input, sizeof(input), "%s/%s.json", dir, corpus->kind);
+        if (gencorpus(gen, corpus, scale, input) != 0) {
+            fprintf(stderr, "Error: could not generate corpus %s\n", corpus->kind);
+            return 1;
+        }
+
+        /* Keep the fastest run; peak RSS is the largest seen. */
+        Result best = {0};
+        long peak = 0;
+        for (int r = 0; r < runs; r++) {
+            Result res;
+            if (runone(bin, input, outdir, &res) != 0) return 1;
+            if (res.peak_rss_kb > peak) peak = res.peak_rss_kb;
+            if (r == 0 || res.wall < best.wall) best = res;
+        }
+        best.peak_rss_kb = peak;
+        if (best.status != 0) failed = 1;
+
+        double mbps = best.wall > 0 ? best.bytes / 1e6 / best.wall : 0;
+        double rps = best.wall > 0 ? best.records / best.wall : 0;
+        double prev = prevmbps(prevpath, corpus->kind);
+        char delta[32] = "-";
+        if (prev > 0) snprintf(delta, sizeof(delta), "%+.1f%%", (mbps - prev) / prev * 100.0);
+
+        printf("%-8s %10ld %8.3f %9.2f %11.0f %10ld %8.3f %8.3f %8.3f %8s%s\n",
+               corpus->kind, best.bytes, best.wall, mbps, rps, best.peak_rss_kb,
+               best.phase[0], best.phase[1], best.phase[2], delta,
+               best.status ? "  (failed)" : "");
+        fprintf(res_fp, "  {\"corpus\": \"%s\", \"bytes\": %ld, \"records\": %ld, \"wall_s\": %.6f, "
+                        "\"user_s\": %.6f, \"sys_s\": %.6f, \"mb_per_s\": %.4f, \"records_per_s\": %.1f, "
+                        "\"peak_rss_kb\": %ld, \"parse_s\": %.6f, \"schema_s\": %.6f, \"csv_s\": %.6f, "
+                        "\"exit\": %d}%s\n",
+                corpus->kind, best.bytes, best.records, best.wall, best.user, best.sys, mbps, rps,
+                best.peak_rss_kb, best.phase[0], best.phase[1], best.phase[2], best.status,
+                c + 1 < CORPUS_COUNT ? "," : "");
+    }
+    fprintf(res_fp, "]}\n");
+    fclose(res_fp);
+    printf("Results written to %s\n", out);
+    return failed;
+}
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Synthetic JSON corpus generator for the json2relcsv benchmarks.
+ *
+ *   jsongen <kind> <count> [seed]
+ *
+ * Every kind scales linearly with <count>:
+ *   wide     root array of <count> objects with WIDE_KEYS scalar fields each
+ *   deep     one object nested <count> levels deep
+ *   array    root array of <count> small flat records
+ *   scalars  root array of <count> records carrying scalar arrays (junction tables)
+ *   escapes  root array of <count> records with escape-heavy strings
+ *   numbers  root array of <count> records made of ints, floats and exponents
+ */
+
+#define WIDE_KEYS 96
+
+static unsigned long long rngstate = 88172645463325252ULL;
+
+static unsigned long long nextrand() {
+    rngstate ^= rngstate << 13;
+    rngstate ^= rngstate >> 7;
+    rngstate ^= rngstate << 17;
+    return rngstate;
+}
+
+static long randrange(long n) {
+    return (long)(nextrand() % (unsigned long long)n);
+}
+
+static void putword(FILE* out) {
+    static const char* words[] = {
+        "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf",
+        "hotel", "india", "juliet", "kilo", "lima", "mike", "november"
+    };
+    fputs(words[randrange(sizeof(words) / sizeof(words[0]))], out);
+}
+
+static void genwide(FILE* out, long count) {
+    fputs("[\n", out);
+    for (long i = 0; i < count; i++) {
+        fputs("  {", out);
+        for (int k = 0; k < WIDE_KEYS; k++) {
+            if (k > 0) fputs(", ", out);
+            switch (k % 3) {
+                case 0:
+                    fprintf(out, "\"field%d\": %ld", k, randrange(100000));
+                    break;
+                case 1:
+                    fprintf(out, "\"field%d\": \"", k);
+                    putword(out);
+                    fputc('"', out);
+                    break;
+                default:
+                    fprintf(out, "\"field%d\": %s", k, randrange(2) ? "true" : "false");
+                    break;
+            }
+        }
+        fprintf(out, "}%s\n", i + 1 < count ? "," : "");
+    }
+    fputs("]\n", out);
+}
+
+static void gendeep(FILE* out, long count) {
+    for (long i = 0; i < count; i++) {
+        fprintf(out, "{\"level\": %ld, \"label\": \"", i);
+        putword(out);
+        fputs("\", \"child\": ", out);
+    }
+    fputs("{\"level\": -1, \"label\": \"leaf\"}", out);
+    for (long i = 0; i < count; i++) {
+        fputc('}', out);
+    }
+    fputc('\n', out);
+}
+
+static void genarray(FILE* out, long count) {
+    fputs("[\n", out);
+    for (long i = 0; i < count; i++) {
+        fprintf(out, "  {\"id\": %ld, \"name\": \"", i + 1);
+        putword(out);
+        fprintf(out, "\", \"price\": %ld.%02ld, \"active\": %s, \"note\": null}%s\n",
+                randrange(1000), randrange(100), randrange(2) ? "true" : "false",
+                i + 1 < count ? "," : "");
+    }
+    fputs("]\n", out);
+}
+
+static void genscalars(FILE* out, long count) {
+    fputs("[\n", out);
+    for (long i = 0; i < count; i++) {
+        fprintf(out, "  {\"id\": %ld, \"tags\": [", i + 1);
+        int ntags = 1 + (int)randrange(6);
+        for (int t = 0; t < ntags; t++) {
+            if (t > 0) fputs(", ", out);
+            fputc('"', out);
+            putword(out);
+            fputc('"', out);
+        }
+        fputs("], \"scores\": [", out);
+        int nscores = 1 + (int)randrange(8);
+        for (int s = 0; s < nscores; s++) {
+            fprintf(out, "%s%ld", s > 0 ? ", " : "", randrange(1000));
+        }
+        fprintf(out, "]}%s\n", i + 1 < count ? "," : "");
+    }
+    fputs("]\n", out);
+}
+
+static void genescapes(FILE* out, long count) {
+    static const char* escapes[] = {
+        "\\\"", "\\\\", "\\n", "\\t", "\\/", "\\r", "\\u00e9", "\\u4e2d", "\\b", "\\f"
+    };
+    fputs("[\n", out);
+    for (long i = 0; i < count; i++) {
+        fprintf(out, "  {\"id\": %ld, \"text\": \"", i + 1);
+        int parts = 8 + (int)randrange(8);
+        for (int p = 0; p < parts; p++) {
+            putword(out);
+            fputs(escapes[randrange(sizeof(escapes) / sizeof(escapes[0]))], out);
+        }
+        fputs("\", \"quote\": \"say \\\"", out);
+        putword(out);
+        fprintf(out, "\\\" twice\"}%s\n", i + 1 < count ? "," : "");
+    }
+    fputs("]\n", out);
+}
+
+static void gennumbers(FILE* out, long count) {
+    fputs("[\n", out);
+    for (long i = 0; i < count; i++) {
+        fprintf(out, "  {\"id\": %ld, \"qty\": %ld, \"delta\": -%ld, \"price\": %ld.%04ld, "
+                     "\"ratio\": 0.%06ld, \"big\": %ldE%ld, \"small\": %ld.5e-%ld}%s\n",
+                i + 1, randrange(10000), randrange(10000), randrange(100000), randrange(10000),
+                randrange(1000000), 1 + randrange(9), randrange(20), 1 + randrange(9),
+                1 + randrange(20), i + 1 < count ? "," : "");
+    }
+    fputs("]\n", out);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <wide|deep|array|scalars|escapes|numbers> <count> [seed]\n", argv[0]);
+        return 1;
+    }
+    long count = atol(argv[2]);
+    if (count < 1) count = 1;
+    if (argc > 3) {
+        rngstate ^= strtoull(argv[3], NULL, 10) * 0x9E3779B97F4A7C15ULL;
+        if (!rngstate) rngstate = 1;
+    }
+
+    const char* kind = argv[1];
+    if (!strcmp(kind, "wide")) {
+        genwide(stdout, count);
+    } else if (!strcmp(kind, "deep")) {
+        gendeep(stdout, count);
+    } else if (!strcmp(kind, "array")) {
+        genarray(stdout, count);
+    } else if (!strcmp(kind, "scalars")) {
+        genscalars(stdout, count);
+    } else if (!strcmp(kind, "escapes")) {
+        genescapes(stdout, count);
+    } else if (!strcmp(kind, "numbers")) {
+        gennumbers(stdout, count);
+    } else {
+        fprintf(stderr, "Unknown corpus kind: %s\n", kind);
+        return 1;
+    }
+    return 0;
+}
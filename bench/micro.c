@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "ast.h"
+#include "schema.h"
+#include "csv.h"
+#include "unescape.h"
+
+/*
+ * Microbenchmarks of the functions that dominate profiles, linked against
+ * the converter's own objects. Every case is timed over parameterized
+ * inputs (key counts, string lengths, escape density, table counts): the
+ * iteration count is calibrated to a minimum repetition time, warmup
+ * repetitions are discarded and the ns/op of the rest is reported as
+ * min, median, mean and standard deviation.
+ *
+ *   micro [--reps N] [--warmup N] [--min-ms N] [--filter TEXT]
+ *
+ * --filter keeps the cases whose name contains TEXT. The parser cases time
+ * a whole yyparse of a generated document and report ns per key or element,
+ * which is where the pairs/values list growth in parser.y shows.
+ */
+
+/* These are defined in parser.y and scanner.l */
+extern int yyparse(void);
+extern void reset_parser();
+extern ASTNode* get_ast_root();
+extern FILE* yyin;
+extern void reset_scanner();
+extern void yyrestart(FILE* input);
+
+typedef void (*BenchFn)(void* arg, long iters);
+
+static int reps = 15;
+static int warmup = 3;
+static double minms = 20;
+static const char* filter = NULL;
+
+static volatile uintptr_t sinkhole;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmpdouble(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Time fn(arg, iters) and report ns per op, where one call of an iteration is per ops */
+static void measure(const char* name, const char* param, BenchFn fn, void* arg, long per) {
+    if (filter && !strstr(name, filter)) return;
+    long iters = 1;
+    for (;;) {
+        double start = now();
+        fn(arg, iters);
+        double elapsed = now() - start;
+        if (elapsed * 1000 >= minms || iters >= (1L << 40)) break;
+        iters *= elapsed > 0 ? (long)fmin(fmax(2, minms / 1000 / elapsed * 1.2), 100) : 100;
+    }
+    for (int i = 0; i < warmup; i++) fn(arg, iters);
+    double* samples = malloc(reps * sizeof(double));
+    if (!samples) return;
+    double sum = 0;
+    for (int i = 0; i < reps; i++) {
+        double start = now();
+        fn(arg, iters);
+        samples[i] = (now() - start) * 1e9 / ((double)iters * per);
+        sum += samples[i];
+    }
+    double mean = sum / reps;
+    double var = 0;
+    for (int i = 0; i < reps; i++) var += (samples[i] - mean) * (samples[i] - mean);
+    qsort(samples, reps, sizeof(double), cmpdouble);
+    printf("%-12s %-22s %10.1f %10.1f %10.1f %8.1f %12ld\n", name, param,
+        samples[0], samples[reps / 2], mean, reps > 1 ? sqrt(var / (reps - 1)) : 0.0, iters);
+    free(samples);
+}
+
+/* A string of len letters where about a density share of the bytes is special */
+static char* makestring(size_t len, double density, char special) {
+    char* s = malloc(len + 1);
+    if (!s) exit(1);
+    unsigned state = 12345;
+    for (size_t i = 0; i < len; i++) {
+        state = state * 1103515245 + 12345;
+        s[i] = (state >> 16) % 10000 < density * 10000 ? special : 'a' + (state >> 8) % 26;
+    }
+    s[len] = '\0';
+    return s;
+}
+
+/* An object with count integer fields named k0, k1, ... */
+static ASTNode* makeobject(int count) {
+    KeyValuePair** pairs = malloc(count * sizeof(KeyValuePair*));
+    if (!pairs) exit(1);
+    for (int i = 0; i < count; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "k%d", i);
+        pairs[i] = createKVpair(key, intnode(i));
+    }
+    return objnode(pairs, count);
+}
+
+static void benchgetbyname(void* arg, long iters) {
+    ASTNode* obj = arg;
+    char key[32];
+    snprintf(key, sizeof(key), "k%d", getcount(obj) - 1);
+    for (long i = 0; i < iters; i++) sinkhole += (uintptr_t)getbyname(obj, key);
+}
+
+static void benchgetsig(void* arg, long iters) {
+    for (long i = 0; i < iters; i++) {
+        char* sig = getsig(arg);
+        sinkhole += (uintptr_t)sig[0];
+        free(sig);
+    }
+}
+
+static void benchesc(void* arg, long iters) {
+    for (long i = 0; i < iters; i++) {
+        char* s = esc(arg);
+        sinkhole += (uintptr_t)s[0];
+        free(s);
+    }
+}
+
+static void benchnodetocsv(void* arg, long iters) {
+    for (long i = 0; i < iters; i++) {
+        char* s = nodetocsv(arg);
+        sinkhole += (uintptr_t)s[0];
+        free(s);
+    }
+}
+
+static void benchunescape(void* arg, long iters) {
+    const char* text = arg;
+    size_t len = strlen(text);
+    for (long i = 0; i < iters; i++) {
+        const char* error = NULL;
+        char* s = unescape(text, len, &error);
+        sinkhole += (uintptr_t)s;
+        free(s);
+    }
+}
+
+typedef struct {
+    Schema* schema;
+    const char* key;
+} Lookup;
+
+static void benchgettablei(void* arg, long iters) {
+    Lookup* lookup = arg;
+    for (long i = 0; i < iters; i++) sinkhole += gettablei(lookup->schema, lookup->key);
+}
+
+static void benchgetibysig(void* arg, long iters) {
+    Lookup* lookup = arg;
+    for (long i = 0; i < iters; i++) sinkhole += getibysig(lookup->schema, lookup->key);
+}
+
+static void benchparse(void* arg, long iters) {
+    const char* doc = arg;
+    for (long i = 0; i < iters; i++) {
+        FILE* in = fmemopen((void*)doc, strlen(doc), "r");
+        if (!in) exit(1);
+        yyin = in;
+        yyrestart(in);
+        reset_scanner();
+        reset_parser();
+        if (yyparse() != 0) {
+            fprintf(stderr, "micro: parse failed\n");
+            exit(1);
+        }
+        deleteast(get_ast_root());
+        fclose(in);
+    }
+}
+
+/* {"k0": 0, ...} with count keys, or [0, ...] with count elements */
+static char* makedoc(int count, int array) {
+    size_t size = 32 + count * 24;
+    char* doc = malloc(size);
+    if (!doc) exit(1);
+    size_t pos = 0;
+    doc[pos++] = array ? '[' : '{';
+    for (int i = 0; i < count; i++) {
+        pos += snprintf(doc + pos, size - pos, array ? "%s%d" : "%s\"k%d\": 0", i ? ", " : "", i);
+    }
+    doc[pos++] = array ? ']' : '}';
+    doc[pos] = '\0';
+    return doc;
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--reps") && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--warmup") && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--min-ms") && i + 1 < argc) {
+            minms = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--reps N] [--warmup N] [--min-ms N] [--filter TEXT]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (reps < 1) reps = 1;
+    if (warmup < 0) warmup = 0;
+    char param[64];
+
+    printf("%-12s %-22s %10s %10s %10s %8s %12s\n", "function", "input", "min ns", "median ns", "mean ns", "sd", "iters");
+
+    static const int keycounts[] = { 4, 16, 64, 256 };
+    for (int i = 0; i < 4; i++) {
+        ASTNode* obj = makeobject(keycounts[i]);
+        snprintf(param, sizeof(param), "keys=%d last", keycounts[i]);
+        measure("getbyname", param, benchgetbyname, obj, 1);
+        snprintf(param, sizeof(param), "keys=%d", keycounts[i]);
+        measure("getsig", param, benchgetsig, obj, 1);
+        deleteast(obj);
+    }
+
+    static const size_t lengths[] = { 16, 256, 4096 };
+    static const double quotes[] = { 0, 0.02, 0.25 };
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            char* s = makestring(lengths[i], quotes[j], '"');
+            snprintf(param, sizeof(param), "len=%zu quotes=%g%%", lengths[i], quotes[j] * 100);
+            measure("esc", param, benchesc, s, 1);
+            ASTNode* node = strnode(s);
+            measure("nodetocsv", param, benchnodetocsv, node, 1);
+            deleteast(node);
+            free(s);
+        }
+    }
+    ASTNode* scalars[] = { intnode(1234567), numnode(3.14159), boolnode(1), nullnode() };
+    static const char* scalarnames[] = { "int", "number", "bool", "null" };
+    for (int i = 0; i < 4; i++) {
+        measure("nodetocsv", scalarnames[i], benchnodetocsv, scalars[i], 1);
+        deleteast(scalars[i]);
+    }
+
+    /* unescape() decodes what the scanner collected between the quotes */
+    static const double escapes[] = { 0, 0.05, 0.5 };
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            size_t len = lengths[i];
+            char* s = makestring(len, escapes[j], '\\');
+            for (size_t k = 0; k < len; k++) {
+                if (s[k] == '\\') {
+                    if (k + 1 == len) s[k] = 'z';
+                    else s[++k] = 'n';
+                }
+            }
+            snprintf(param, sizeof(param), "len=%zu escapes=%g%%", len, escapes[j] * 100);
+            measure("unescape", param, benchunescape, s, 1);
+            free(s);
+        }
+    }
+
+    static const int tablecounts[] = { 8, 32, MAX_TABLES };
+    for (int i = 0; i < 3; i++) {
+        Schema* schema = makeSchema();
+        char name[32];
+        char sig[64];
+        for (int t = 0; t < tablecounts[i]; t++) {
+            snprintf(name, sizeof(name), "table%d", t);
+            int index = addT(schema, name, 0, 0);
+            snprintf(sig, sizeof(sig), "id,name,k%d,total", t);
+            if (index >= 0) schema->tables[index].signature = strdup(sig);
+        }
+        Lookup lookup = { schema, name };
+        snprintf(param, sizeof(param), "tables=%d last", schema->table_count);
+        measure("gettablei", param, benchgettablei, &lookup, 1);
+        lookup.key = sig;
+        measure("getibysig", param, benchgetibysig, &lookup, 1);
+        delSchema(schema);
+    }
+
+    static const int elements[] = { 16, 256, 4096 };
+    for (int i = 0; i < 3; i++) {
+        char* doc = makedoc(elements[i], 0);
+        snprintf(param, sizeof(param), "keys=%d per key", elements[i]);
+        measure("parse-pairs", param, benchparse, doc, elements[i]);
+        free(doc);
+        doc = makedoc(elements[i], 1);
+        snprintf(param, sizeof(param), "elements=%d per elem", elements[i]);
+        measure("parse-values", param, benchparse, doc, elements[i]);
+        free(doc);
+    }
+    return 0;
+}
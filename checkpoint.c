@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include "checkpoint.h"
+#include "csv.h"
+
+#define CHECKPOINT_FILE ".json2relcsv.checkpoint"
+#define APPEND_FILE ".json2relcsv.schema"
+
+/* Open a state file for writing under a temporary name */
+static FILE* openstate(const char* path, char* tmppath) {
+    sprintf(tmppath, "%s.tmp", path);
+    FILE* fp = fopen(tmppath, "w");
+    if (!fp) fprintf(stderr, "Error: Could not write %s: %s\n", tmppath, strerror(errno));
+    return fp;
+}
+
+/* Flush the state file to disk and move it over the previous one */
+static int commitstate(FILE* fp, const char* tmppath, const char* path) {
+    int ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok || rename(tmppath, path) != 0) {
+        fprintf(stderr, "Error: Could not write %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+/* Write the checkpoint next to the CSV files, replacing the previous one atomically */
+int savecheckpoint(Schema* schema, const char* output_dir, Checkpoint* cp) {
+    char path[512];
+    char tmppath[520];
+    sprintf(path, "%s/%s", output_dir, CHECKPOINT_FILE);
+    FILE* fp = openstate(path, tmppath);
+    if (!fp) return 0;
+    fprintf(fp, "checkpoint 1\noffset %ld\nrecords %ld\nnextid %ld\n", cp->offset, cp->records, cp->nextid);
+    int files = 0;
+    for (int i = 0; i < schema->table_count; i++) {
+        if (gettablei(schema, schema->tables[i].name) == i) files++;
+    }
+    fprintf(fp, "files %d\n", files);
+    for (int i = 0; i < schema->table_count; i++) {
+        const char* name = schema->tables[i].name;
+        if (gettablei(schema, name) != i) continue;
+        char csvpath[512];
+        struct stat st;
+        sprintf(csvpath, "%s/%s.csv", output_dir, name);
+        long size = stat(csvpath, &st) == 0 ? (long)st.st_size : 0;
+        fprintf(fp, "%ld %zu:%s\n", size, strlen(name), name);
+    }
+    saveschema(schema, fp, 1);
+    return commitstate(fp, tmppath, path);
+}
+
+/* Load the checkpoint into an empty schema and cut the CSV files back to it */
+int loadcheckpoint(Schema* schema, const char* output_dir, Checkpoint* cp) {
+    char path[512];
+    sprintf(path, "%s/%s", output_dir, CHECKPOINT_FILE);
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error: No checkpoint to resume from in %s\n", output_dir);
+        return 0;
+    }
+    int version, files;
+    int ok = fscanf(fp, "checkpoint %d offset %ld records %ld nextid %ld files %d",
+                    &version, &cp->offset, &cp->records, &cp->nextid, &files) == 5 && version == 1;
+    long* sizes = ok ? calloc(files + 1, sizeof(long)) : NULL;
+    char** names = ok ? calloc(files + 1, sizeof(char*)) : NULL;
+    if (!sizes || !names) ok = 0;
+    for (int i = 0; ok && i < files; i++) {
+        size_t len;
+        ok = fscanf(fp, "%ld %zu:", &sizes[i], &len) == 2;
+        if (ok) names[i] = malloc(len + 1);
+        ok = ok && names[i] && fread(names[i], 1, len, fp) == len;
+        if (ok) names[i][len] = '\0';
+    }
+    if (ok) ok = loadschema(schema, fp);
+    fclose(fp);
+    if (!ok) fprintf(stderr, "Error: Malformed checkpoint %s\n", path);
+    for (int i = 0; ok && i < files; i++) {
+        char csvpath[512];
+        sprintf(csvpath, "%s/%s.csv", output_dir, names[i]);
+        if (truncate(csvpath, sizes[i]) != 0 && sizes[i] > 0) {
+            fprintf(stderr, "Error: Could not truncate %s: %s\n", csvpath, strerror(errno));
+            ok = 0;
+        }
+    }
+    for (int i = 0; names && i < files; i++) free(names[i]);
+    free(names);
+    free(sizes);
+    return ok;
+}
+
+void clearcheckpoint(const char* output_dir) {
+    char path[512];
+    sprintf(path, "%s/%s", output_dir, CHECKPOINT_FILE);
+    unlink(path);
+}
+
+/* Check that every file still starts with the header the saved schema gave it */
+static int checkheaders(Schema* schema, const char* output_dir) {
+    int ok = 1;
+    for (int i = 0; ok && i < schema->table_count; i++) {
+        Table* table = &schema->tables[i];
+        if (gettablei(schema, table->name) != i || table->header_columns == 0) continue;
+        int last = i;
+        for (int j = i + 1; j < schema->table_count; j++) {
+            if (strcmp(schema->tables[j].name, table->name) == 0) last = j;
+        }
+        char* expected = NULL;
+        size_t expectedlen = 0;
+        FILE* mem = open_memstream(&expected, &expectedlen);
+        if (!mem) return 0;
+        csvheader(schema, last, mem);
+        fclose(mem);
+        char csvpath[512];
+        sprintf(csvpath, "%s/%s.csv", output_dir, table->name);
+        FILE* fp = fopen(csvpath, "r");
+        char* line = NULL;
+        size_t cap = 0;
+        ok = fp && getline(&line, &cap, fp) >= 0 && strcmp(line, expected) == 0;
+        if (!ok) fprintf(stderr, "Error: %s does not match the schema saved in %s\n", csvpath, APPEND_FILE);
+        if (fp) fclose(fp);
+        free(line);
+        free(expected);
+    }
+    return ok;
+}
+
+/* Largest id in the first column of a CSV file, counting its rows; quoted newlines stay in their row */
+static long maxid(FILE* fp, long* rows) {
+    char buf[65536];
+    size_t n;
+    long max = 0;
+    long id = 0;
+    int quoted = 0;
+    int start = 1;
+    int first = 0;
+    *rows = 0;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            char c = buf[i];
+            if (start) {
+                (*rows)++;
+                id = 0;
+                first = 1;
+                start = 0;
+            }
+            if (c == '"') {
+                quoted = !quoted;
+            } else if (!quoted && c == '\n') {
+                if (id > max) max = id;
+                start = 1;
+            } else if (first && c >= '0' && c <= '9') {
+                id = id * 10 + (c - '0');
+            } else if (first && c == ',') {
+                first = 0;
+            }
+        }
+    }
+    if (!start && id > max) max = id;
+    return max;
+}
+
+static int csvfile(const struct dirent* entry) {
+    size_t len = strlen(entry->d_name);
+    return len > 4 && strcmp(entry->d_name + len - 4, ".csv") == 0;
+}
+
+/*
+ * Without a saved schema, take each CSV file's header as a table that only
+ * owns the file, so that rows are appended under it, and continue the ids
+ * after the largest one found.
+ */
+static int scanoutput(Schema* schema, const char* output_dir, long* nextid) {
+    struct dirent** entries;
+    int count = scandir(output_dir, &entries, csvfile, alphasort);
+    if (count < 0) return errno == ENOENT;
+    long max = 0;
+    for (int i = 0; i < count; i++) {
+        char csvpath[512];
+        sprintf(csvpath, "%s/%s", output_dir, entries[i]->d_name);
+        entries[i]->d_name[strlen(entries[i]->d_name) - 4] = '\0';
+        FILE* fp = fopen(csvpath, "r");
+        char* line = NULL;
+        size_t cap = 0;
+        ssize_t len = fp ? getline(&line, &cap, fp) : -1;
+        int table_index = len > 0 ? addT(schema, entries[i]->d_name, 0, 0) : -1;
+        if (table_index >= 0) {
+            Table* table = &schema->tables[table_index];
+            if (line[len - 1] == '\n') line[len - 1] = '\0';
+            /* addT created the id column */
+            char* comma = strchr(line, ',');
+            while (comma) {
+                char* name = comma + 1;
+                comma = strchr(name, ',');
+                if (comma) *comma = '\0';
+                addC(schema, table_index, name, COL_STRING, NULL);
+            }
+            table->header_columns = table->column_count;
+            long id = maxid(fp, &table->rows_written);
+            if (id > max) max = id;
+        }
+        if (fp) fclose(fp);
+        free(line);
+        free(entries[i]);
+    }
+    free(entries);
+    *nextid = max + 1;
+    return 1;
+}
+
+/*
+ * Load the state of the earlier runs in the output directory for --append:
+ * the saved schema when there is one, otherwise the headers and ids of the
+ * CSV files. *nextid is set past every id already written.
+ */
+int loadappend(Schema* schema, const char* output_dir, long* nextid) {
+    char path[512];
+    sprintf(path, "%s/%s", output_dir, APPEND_FILE);
+    *nextid = 1;
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        if (!scanoutput(schema, output_dir, nextid)) return 0;
+        /* Rows numbered from their own sequence continue after every id found as well */
+        if (schema->next_row_id) schema->next_row_id = *nextid;
+        return 1;
+    }
+    long rowid = schema->next_row_id;
+    int version;
+    int ok = fscanf(fp, "append %d nextid %ld", &version, nextid) == 2 && version == 1 && loadschema(schema, fp);
+    fclose(fp);
+    if (!ok) {
+        fprintf(stderr, "Error: Malformed append state %s\n", path);
+        return 0;
+    }
+    /* Keep the row id sequence of this run's mode, continuing after every id used so far */
+    long last = schema->next_row_id > *nextid ? schema->next_row_id : *nextid;
+    if (rowid) {
+        schema->next_row_id = last;
+    } else {
+        schema->next_row_id = 0;
+        *nextid = last;
+    }
+    return checkheaders(schema, output_dir);
+}
+
+/* Save the schema and id counter of an --append run for the next one */
+int saveappend(Schema* schema, const char* output_dir, long nextid) {
+    char path[512];
+    char tmppath[520];
+    sprintf(path, "%s/%s", output_dir, APPEND_FILE);
+    FILE* fp = openstate(path, tmppath);
+    if (!fp) return 0;
+    fprintf(fp, "append 1\nnextid %ld\n", nextid);
+    saveschema(schema, fp, 1);
+    return commitstate(fp, tmppath, path);
+}
+
+void clearappend(const char* output_dir) {
+    char path[512];
+    sprintf(path, "%s/%s", output_dir, APPEND_FILE);
+    unlink(path);
+}
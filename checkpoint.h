@@ -0,0 +1,34 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "schema.h"
+
+/*
+ * Checkpoints of a --pipeline run (--checkpoint N, --resume). Every N records
+ * of the root array, the emitter stores in the output directory the input
+ * offset just past the last written record, the number of records written,
+ * the next AST node id, the committed length of every CSV file and the
+ * schema with its run state. --resume loads the checkpoint, truncates the
+ * files back to their committed lengths and continues parsing at the offset.
+ *
+ * An --append run saves its schema and id counter in the output directory
+ * the same way, so that the next --append run continues the ids, appends to
+ * the files and only rewrites a header when a table gains columns. Without
+ * a saved schema the headers of the CSV files are read and the ids continue
+ * after the largest one in their first columns.
+ */
+
+typedef struct {
+    long offset;        /* Input bytes up to and including the last record */
+    long records;       /* Records of the root array written */
+    long nextid;        /* Next AST node id */
+} Checkpoint;
+
+int savecheckpoint(Schema* schema, const char* output_dir, Checkpoint* cp);
+int loadcheckpoint(Schema* schema, const char* output_dir, Checkpoint* cp);
+void clearcheckpoint(const char* output_dir);
+int loadappend(Schema* schema, const char* output_dir, long* nextid);
+int saveappend(Schema* schema, const char* output_dir, long nextid);
+void clearappend(const char* output_dir);
+
+#endif
@@ -6,6 +6,11 @@
 #include <errno.h>
 #include "csv.h"
 #include "helper.h"
+#include "writer.h"
+#include "profile.h"
+#include "shard.h"
+#include "sink.h"
+#include "trace.h"
 
 char* esc(const char* s) {
     if (!s) return strdup("");
@@ -49,22 +54,22 @@ char* nodetocsv(ASTNode* node) {
         default:
             break;
     }
-    switch (node->type) {
+    switch (nodetype(node)) {
         case nodestr: {
-            return esc(node->value.strVal);
+            return esc(getstr(node));
         }
         case nodeint: {
             char buf[32];
-            sprintf(buf, "%ld", node->value.intVal);
+            sprintf(buf, "%ld", getint(node));
             return strdup(buf);
         }
         case nodenum: {
             char buf[32];
-            sprintf(buf, "%g", node->value.numVal);
+            sprintf(buf, "%g", getnum(node));
             return strdup(buf);
         }
         case nodebool: {
-            switch (node->value.boolVal) {
+            switch (getbool(node)) {
                 case 1:
                     return strdup("true");
                 default:
@@ -80,26 +85,292 @@ char* nodetocsv(ASTNode* node) {
 }
 
 /* Write CSV header row */
-void csvheader(Schema* schema, int table_index, FILE* fp) {
+long csvheader(Schema* schema, int table_index, FILE* fp) {
     Table* table = &schema->tables[table_index];
+    long bytes = 0;
     int i = 0;
     while (i < table->column_count) {
-        fprintf(fp, "%s", table->columns[i].name);
+        bytes += fprintf(fp, "%s", table->columns[i].name);
 
         switch (i < table->column_count - 1) {
             case 1:
-                fprintf(fp, ",");
+                bytes += fprintf(fp, ",");
                 break;
             default:
                 break;
         }
         i++;
     }
-    fprintf(fp, "\n");
+    bytes += fprintf(fp, "\n");
+    return bytes;
 }
 
-void scalarcsv(Schema* schema, int table_index, ASTNode* array, 
-                           FILE* fp, long parent_id) {
+/* Open a CSV file for writing, through the I/O thread with --async-io */
+static FILE* openout(const char* path, const char* mode) {
+    return writing() ? asyncopen(path, mode) : fopen(path, mode);
+}
+
+/* Last table with the name of owner: its columns are the header of the file */
+static int lasttable(Schema* schema, int owner) {
+    int last = owner;
+    for (int j = owner + 1; j < schema->table_count; j++) {
+        if (strcmp(schema->tables[j].name, schema->tables[owner].name) == 0) last = j;
+    }
+    return last;
+}
+
+/* Open a shard of a table, creating it with its header */
+static FILE* openshard(Schema* schema, int table_index, int shard, const char* output_dir, const char* mode) {
+    Table* table = &schema->tables[table_index];
+    int owner = gettablei(schema, table->name);
+    char path[512];
+    shardpath(path, output_dir, table->name, shard);
+    double traced = tracing() ? tracetime() : 0;
+    int create = mode[0] == 'a' && !shardheader(owner, shard);
+    FILE* fp = openout(path, create ? "w" : mode);
+    if (!fp) return NULL;
+    table->file_opens++;
+    int header = lasttable(schema, owner);
+    if (create) shardwrote(owner, shard, 0, csvheader(schema, header, fp));
+    if (create || mode[0] == 'w') setshardheader(owner, shard, schema->tables[header].column_count);
+    if (traced) tracesampled("open", "csv", traced, table->name, shard);
+    return fp;
+}
+
+/* Open the CSV file of a table, counting the open for --stats */
+FILE* opentable(Schema* schema, int table_index, const char* output_dir, const char* mode) {
+    if (table_index < 0 || table_index >= schema->table_count) return NULL;
+    Table* table = &schema->tables[table_index];
+    char path[512];
+    sprintf(path, "%s/%s.csv", output_dir, table->name);
+    double traced = tracing() ? tracetime() : 0;
+    /* A file gets its header when its first row is appended */
+    int owner = gettablei(schema, table->name);
+    int create = mode[0] == 'a' && schema->tables[owner].header_columns == 0;
+    FILE* fp = openout(path, create ? "w" : mode);
+    if (!fp) return NULL;
+    table->file_opens++;
+    if (create) {
+        csvheader(schema, owner, fp);
+        schema->tables[owner].header_columns = schema->tables[owner].column_count;
+    }
+    if (traced) tracesampled("open", "csv", traced, table->name, -1);
+    return fp;
+}
+
+/* Close the CSV file of a table, which flushes its rows */
+static void closetable(Schema* schema, int table_index, FILE* fp) {
+    double traced = tracing() ? tracetime() : 0;
+    fclose(fp);
+    if (traced) tracesampled("close", "csv", traced, schema->tables[table_index].name, -1);
+}
+
+/*
+ * Find the table for an object, creating tables for its shape when discovering
+ * while writing; parentKey is the key the object is the value of, if any.
+ */
+int tableforobj(Schema* schema, ASTNode* obj, const char* parentTable, const char* parentKey, int index) {
+    int tableIndex = getibyshape(schema, getshape(obj));
+    if (tableIndex < 0 && schema->discover) {
+        tableIndex = discoverobj(schema, obj, parentTable, parentKey, index);
+        if (tableIndex >= 0 && schema->manifest) {
+            fprintf(stderr, "Warning: Shape %s is not in the schema manifest, added as table %s\n",
+                    schema->tables[tableIndex].signature, schema->tables[tableIndex].name);
+        }
+    }
+    return tableIndex;
+}
+
+/* Natural key value of obj in its table, NULL when the table or object has none */
+static char* entitykey(Table* table, ASTNode* obj) {
+    if (!table->natural_key) return NULL;
+    ASTNode* field = getbyname(obj, table->natural_key);
+    if (!field || !scalar(field)) return NULL;
+    return nodetocsv(field);
+}
+
+/* Row id of an earlier entity with obj's natural key, or 0 after recording obj under rowId */
+static long seenentity(Table* table, ASTNode* obj, long rowId) {
+    char* key = entitykey(table, obj);
+    if (!key) return 0;
+    long existing = findentity(&table->entities, key);
+    if (!existing) addentity(&table->entities, key, rowId);
+    free(key);
+    return existing;
+}
+
+/*
+ * With --dedup-subtrees, an object is written once per distinct subtree when
+ * its row holds nothing from where it appears: it is not an array element
+ * and has no foreign key to the table of its parent.
+ */
+static int dedupable(Schema* schema, Table* table, const char* parentTable, int index) {
+    if (!schema->dedup || index >= 0) return 0;
+    for (int i = 0; i < table->column_count; i++) {
+        Column* col = &table->columns[i];
+        if (col->type == COL_FOREIGN_KEY && col->references && parentTable &&
+            strcmp(col->references, parentTable) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Row id of an identical subtree written to the table before, 0 if there is
+ * none. Only a subtree with the same hash is compared in full, and the
+ * reference to an object and its own row compare it once.
+ */
+static long findsubtree(Table* table, ASTNode* obj) {
+    EntityEntry* e = findhashed(&table->subtrees, gethash(obj));
+    if (!e) return 0;
+    long id = getnodeID(obj);
+    if (e->checked != id) {
+        if (!subtreeis(obj, e->key)) return 0;
+        e->checked = id;
+    }
+    return e->row_id;
+}
+
+/* As findsubtree, recording obj under rowId when no subtree with its hash was written */
+static long seensubtree(Table* table, ASTNode* obj, long rowId) {
+    if (findhashed(&table->subtrees, gethash(obj))) return findsubtree(table, obj);
+    char* key = subtreekey(obj);
+    addhashed(&table->subtrees, gethash(obj), key, rowId);
+    free(key);
+    return 0;
+}
+
+/* Row id a reference from a row of parentTable to obj resolves to */
+static long refid(Schema* schema, ASTNode* obj, const char* parentTable, const char* parentKey) {
+    if (!schema->keyed_tables && !schema->dedup) return getnodeID(obj);
+    int tableIndex = tableforobj(schema, obj, parentTable, parentKey, -1);
+    if (tableIndex >= 0) {
+        Table* table = &schema->tables[tableIndex];
+        char* key = entitykey(table, obj);
+        if (key) {
+            long existing = findentity(&table->entities, key);
+            free(key);
+            if (existing) return existing;
+        }
+        if (dedupable(schema, table, parentTable, -1)) {
+            long existing = findsubtree(table, obj);
+            if (existing) return existing;
+        }
+    }
+    return getnodeID(obj);
+}
+
+/* Cell holding a scalar node, pointing at its string in the AST */
+static void nodecell(Cell* cell, ASTNode* node) {
+    switch (node ? nodetype(node) : nodenull) {
+        case nodestr:
+            cell->type = CELL_STR;
+            cell->value.strVal = getstr(node);
+            break;
+        case nodeint:
+            cell->type = CELL_INT;
+            cell->value.intVal = getint(node);
+            break;
+        case nodenum:
+            cell->type = CELL_NUM;
+            cell->value.numVal = getnum(node);
+            break;
+        case nodebool:
+            cell->type = CELL_BOOL;
+            cell->value.boolVal = getbool(node);
+            break;
+        default:
+            cell->type = CELL_NULL;
+            break;
+    }
+}
+
+static void intcell(Cell* cell, long value) {
+    cell->type = CELL_INT;
+    cell->value.intVal = value;
+}
+
+/* Cell of a field of a fixed layout, null unless the node has the given type */
+static void typedcell(Cell* cell, ASTNode* node, NodeType type) {
+    nodecell(cell, node && nodetype(node) == type ? node : NULL);
+}
+
+/*
+ * The table of a fixed layout with its own header: the last table with the
+ * name and exactly these columns, added when there is none. Sharing the name
+ * with inferred tables, it is the one whose header the file ends up with.
+ */
+static int fixedtable(Schema* schema, const char* name, const char** columns, int count) {
+    for (int i = schema->table_count - 1; i >= 0; i--) {
+        Table* table = &schema->tables[i];
+        if (strcmp(table->name, name) != 0 || table->column_count != count) continue;
+        int j = 0;
+        while (j < count && strcmp(table->columns[j].name, columns[j]) == 0) j++;
+        if (j == count) return i;
+    }
+    int table_index = addT(schema, name, 0, 0);
+    if (table_index < 0) return -1;
+    /* addT named the first column id */
+    Column* first = &schema->tables[table_index].columns[0];
+    free(first->name);
+    first->name = strdup(columns[0]);
+    for (int j = 1; j < count; j++) addC(schema, table_index, columns[j], COL_STRING, NULL);
+    return table_index;
+}
+
+static const char* usercolumns[] = { "id", "uid", "name" };
+
+/*
+ * Row id of the user with uidNode's value in a posts document. A user seen for
+ * the first time gets the next id and a row in the users table; users without
+ * a uid share the empty key.
+ */
+static long writeuser(Schema* schema, EntityIndex* users, int usersTable, ASTNode* uidNode, ASTNode* nameNode) {
+    char* uidVal = uidNode && nodetype(uidNode) == nodestr ? nodetocsv(uidNode) : strdup("");
+    long userId = findentity(users, uidVal);
+    if (!userId) {
+        userId = users->count + 1;
+        addentity(users, uidVal, userId);
+        Cell cells[3];
+        intcell(&cells[0], userId);
+        typedcell(&cells[1], uidNode, nodestr);
+        typedcell(&cells[2], nameNode, nodestr);
+        sinkrow(schema, usersTable, cells, 3);
+    }
+    free(uidVal);
+    return userId;
+}
+
+/* Record the final size of every CSV file for --stats */
+void measurecsv(Schema* schema, const char* output_dir) {
+    int i = 0;
+    while (i < schema->table_count) {
+        Table* table = &schema->tables[i];
+        char path[512];
+        struct stat st;
+        int owner = gettablei(schema, table->name);
+        if (sharding() && sharded(schema, owner)) {
+            table->bytes_written = 0;
+            for (int shard = 0; shard < shardsused(owner); shard++) {
+                shardpath(path, output_dir, table->name, shard);
+                if (stat(path, &st) == 0) table->bytes_written += st.st_size;
+            }
+            i++;
+            continue;
+        }
+        sprintf(path, "%s/%s.csv", output_dir, table->name);
+        table->bytes_written = stat(path, &st) == 0 ? (long)st.st_size : 0;
+        i++;
+    }
+}
+
+/* Id for a row that has no AST node of its own */
+static long newrowid(Schema* schema) {
+    return schema->next_row_id ? schema->next_row_id++ : getnid();
+}
+
+void scalarcsv(Schema* schema, int table_index, ASTNode* array, long parent_id) {
     switch (!isArray(array) || table_index < 0 || table_index >= schema->table_count) {
         case 1:
             return;
@@ -107,426 +378,431 @@ void scalarcsv(Schema* schema, int table_index, ASTNode* array,
             break;
     }
     int i = 0;
-    while (i < array->value.array.elemCount) {
-        ASTNode* item = array->value.array.elements[i];
-        long row_id = getnid();
-        fprintf(fp, "%ld,", row_id);     
-        fprintf(fp, "%ld,", parent_id);
-        fprintf(fp, "%d,", i);           
-        char* value = nodetocsv(item);
-        fprintf(fp, "%s", value);
-        free(value);
-        fprintf(fp, "\n");
+    while (i < getcount(array)) {
+        Cell cells[4];
+        intcell(&cells[0], newrowid(schema));
+        intcell(&cells[1], parent_id);
+        intcell(&cells[2], i);
+        nodecell(&cells[3], getchild(array, i));
+        sinkrow(schema, table_index, cells, 4);
         i++;
     }
 }
 
-void writeOrderItems(Schema* schema, ASTNode* obj, FILE* fp, long parentId, int index, const char* outputDir) {
+void writeOrderItems(Schema* schema, int tableIndex, ASTNode* obj, long parentId, int index) {
     ASTNode* skuNode = getbyname(obj, "sku");
     ASTNode* qtyNode = getbyname(obj, "qty");
     ASTNode* nameNode = getbyname(obj, "name");
     ASTNode* priceNode = getbyname(obj, "price");
     ASTNode* quantityNode = getbyname(obj, "quantity");
     int isSimple = (skuNode && qtyNode && !nameNode && !priceNode && !quantityNode) ? 1 : 0;
-    if (isSimple) {
-        long itemId = getnid();
-        fprintf(fp, "%ld,%ld,%d,", itemId, parentId, index);
-        if (skuNode && skuNode->type == nodestr) {
-            char* skuVal = nodetocsv(skuNode);
-            fprintf(fp, "%s,", skuVal);
-            free(skuVal);
-        } else {
-            fprintf(fp, ",");
-        }
-        if (qtyNode && qtyNode->type == nodeint) {
-            fprintf(fp, "%ld", qtyNode->value.intVal);
-        } else {
-            fprintf(fp, ",");
-        }
-        fprintf(fp, "\n");
-        return;
-    }
-    long itemId = getnid();
-    fprintf(fp, "%ld,%ld,%d,", itemId, parentId, index);
-    if (skuNode && skuNode->type == nodestr) {
-        char* skuVal = nodetocsv(skuNode);
-        fprintf(fp, "%s,", skuVal);
-        free(skuVal);
-    } else {
-        fprintf(fp, ",");
+    Cell cells[7];
+    int count = 0;
+    intcell(&cells[count++], newrowid(schema));
+    intcell(&cells[count++], parentId);
+    intcell(&cells[count++], index);
+    typedcell(&cells[count++], skuNode, nodestr);
+    if (!isSimple) {
+        typedcell(&cells[count++], nameNode, nodestr);
+        int priced = priceNode && (nodetype(priceNode) == nodenum || nodetype(priceNode) == nodeint);
+        nodecell(&cells[count++], priced ? priceNode : NULL);
+        if (!qtyNode) qtyNode = quantityNode;
     }
-    if (nameNode && nameNode->type == nodestr) {
-        char* nameVal = nodetocsv(nameNode);
-        fprintf(fp, "%s,", nameVal);
-        free(nameVal);
-    } else {
-        fprintf(fp, ",");
-    }
-    if (priceNode && (priceNode->type == nodenum || priceNode->type == nodeint)) {
-        if (priceNode->type == nodenum) {
-            fprintf(fp, "%.2f,", priceNode->value.numVal);
-        } else {
-            fprintf(fp, "%ld,", priceNode->value.intVal);
-        }
-    } else {
-        fprintf(fp, ",");
-    }
-    if (!qtyNode) {
-        qtyNode = getbyname(obj, "quantity");
-        if (!qtyNode) {
-            qtyNode = getbyname(obj, "qty");
-        }
-    }
-    if (qtyNode && qtyNode->type == nodeint) {
-        fprintf(fp, "%ld", qtyNode->value.intVal);
-    } else {
-        fprintf(fp, ",");
-    }
-    fprintf(fp, "\n");
+    typedcell(&cells[count++], qtyNode, nodeint);
+    sinkrow(schema, tableIndex, cells, count);
 }
 
-void writeOrders(Schema* schema, ASTNode* obj, FILE* fp, const char* outputDir) {
-    fprintf(fp, "%ld,", obj->node_id);
-    ASTNode* orderIdNode = getbyname(obj, "orderId");
-    if (orderIdNode && orderIdNode->type == nodeint) {
-        fprintf(fp, "%ld,", orderIdNode->value.intVal);
-    } else {
-        fprintf(fp, ",");
-    }
+void writeOrders(Schema* schema, int tableIndex, ASTNode* obj) {
     ASTNode* customerNode = getbyname(obj, "customer");
-    if (customerNode && isobj(customerNode)) {
-        fprintf(fp, "%ld,", customerNode->node_id);
-    } else {
-        fprintf(fp, ",");
-    }
     ASTNode* totalNode = getbyname(obj, "total");
-    if (totalNode) {
-        if (totalNode->type == nodenum) {
-            fprintf(fp, "%.2f,", totalNode->value.numVal);
-        } else if (totalNode->type == nodeint) {
-            fprintf(fp, "%ld,", totalNode->value.intVal);
-        } else {
-            fprintf(fp, ",");
-        }
-    } else {
-        fprintf(fp, ",");
-    }
-    ASTNode* dateNode = getbyname(obj, "date");
-    if (dateNode && dateNode->type == nodestr) {
-        char* dateVal = nodetocsv(dateNode);
-        fprintf(fp, "%s", dateVal);
-        free(dateVal);
-    } else {
-        fprintf(fp, ",");
-    }
-    fprintf(fp, "\n");
+    int custTableIndex = gettablei(schema, "customers");
+    long custId = 0;
+    int newCustomer = 1;
     if (customerNode && isobj(customerNode)) {
-        int custTableIndex = gettablei(schema, "customers");
+        custId = getnodeID(customerNode);
         if (custTableIndex >= 0) {
-            char path[512];
-            sprintf(path, "%s/customers.csv", outputDir);
-            FILE* custFp = fopen(path, "a");
-            if (custFp) {
-                fprintf(custFp, "%ld,", customerNode->node_id);
-                ASTNode* idNode = getbyname(customerNode, "id");
-                if (idNode) {
-                    char* idVal = nodetocsv(idNode);
-                    fprintf(custFp, "%s,", idVal);
-                    free(idVal);
-                } else {
-                    fprintf(custFp, ",");
-                }
-                ASTNode* nameNode = getbyname(customerNode, "name");
-                if (nameNode && nameNode->type == nodestr) {
-                    char* nameVal = nodetocsv(nameNode);
-                    fprintf(custFp, "%s", nameVal);
-                    free(nameVal);
-                } else {
-                    fprintf(custFp, ",");
-                }
-                fprintf(custFp, "\n");
-                fclose(custFp);
+            long existing = seenentity(&schema->tables[custTableIndex], customerNode, custId);
+            if (existing) {
+                custId = existing;
+                newCustomer = 0;
             }
         }
     }
+    Cell cells[5];
+    intcell(&cells[0], getnodeID(obj));
+    typedcell(&cells[1], getbyname(obj, "orderId"), nodeint);
+    nodecell(&cells[2], NULL);
+    if (customerNode && isobj(customerNode)) intcell(&cells[2], custId);
+    int totaled = totalNode && (nodetype(totalNode) == nodenum || nodetype(totalNode) == nodeint);
+    nodecell(&cells[3], totaled ? totalNode : NULL);
+    typedcell(&cells[4], getbyname(obj, "date"), nodestr);
+    sinkrow(schema, tableIndex, cells, 5);
+    if (customerNode && isobj(customerNode) && newCustomer && custTableIndex >= 0) {
+        Cell customer[3];
+        intcell(&customer[0], custId);
+        nodecell(&customer[1], getbyname(customerNode, "id"));
+        typedcell(&customer[2], getbyname(customerNode, "name"), nodestr);
+        sinkrow(schema, custTableIndex, customer, 3);
+    }
     ASTNode* itemsNode = getbyname(obj, "items");
-    if (itemsNode && itemsNode->type == nodearr) {
+    if (itemsNode && nodetype(itemsNode) == nodearr) {
         int itemsTableIndex = gettablei(schema, "order_items");
         if (itemsTableIndex >= 0) {
-            char path[512];
-            sprintf(path, "%s/order_items.csv", outputDir);
-            FILE* itemsFp = fopen(path, "a");
-            if (itemsFp) {
-                int i = 0;
-                while (i < itemsNode->value.array.elemCount) {
-                    ASTNode* item = itemsNode->value.array.elements[i];
-                    if (isobj(item)) {
-                        writeobj(schema, itemsTableIndex, item, itemsFp, obj->node_id, i, "orders", outputDir);
-                    }
-                    i++;
+            int i = 0;
+            while (i < getcount(itemsNode)) {
+                ASTNode* item = getchild(itemsNode, i);
+                if (isobj(item)) {
+                    writeobj(schema, itemsTableIndex, item, getnodeID(obj), i, "orders");
                 }
-                fclose(itemsFp);
+                i++;
             }
         }
     }
 }
 
-void writePosts(Schema* schema, ASTNode* obj, FILE* fp, const char* outputDir) {
+void writePosts(Schema* schema, int tableIndex, ASTNode* obj) {
     ASTNode* postIdNode = getbyname(obj, "postId");
     ASTNode* authorNode = getbyname(obj, "author");
     if (postIdNode && authorNode && isobj(authorNode)) {
-        fprintf(fp, "1,");
-        if (postIdNode->type == nodeint) {
-            fprintf(fp, "%ld", postIdNode->value.intVal);
-        } else {
-            fprintf(fp, "0");
-        }
-        fprintf(fp, ",1\n");
         int usersTableIndex = gettablei(schema, "users");
-        if (usersTableIndex >= 0) {
-            char path[512];
-            sprintf(path, "%s/users.csv", outputDir);
-            FILE* usersFp = fopen(path, "a");
-            if (usersFp) {
-                ASTNode* uidNode = getbyname(authorNode, "uid");
-                ASTNode* nameNode = getbyname(authorNode, "name");
-                fprintf(usersFp, "1,");
-                if (uidNode && uidNode->type == nodestr) {
-                    char* uidVal = nodetocsv(uidNode);
-                    fprintf(usersFp, "%s", uidVal);
-                    free(uidVal);
-                } else {
-                    fprintf(usersFp, ",");
-                }
-                fprintf(usersFp, ",");
-                if (nameNode && nameNode->type == nodestr) {
-                    char* nameVal = nodetocsv(nameNode);
-                    fprintf(usersFp, "%s", nameVal);
-                    free(nameVal);
-                } else {
-                    fprintf(usersFp, ",");
-                }
-                fprintf(usersFp, "\n");
-                fclose(usersFp);
-            }
-        }
+        if (usersTableIndex < 0) usersTableIndex = fixedtable(schema, "users", usercolumns, 3);
+        EntityIndex looseUsers = { NULL, 0, 0 };
+        EntityIndex* users = usersTableIndex >= 0 ? &schema->tables[usersTableIndex].entities : &looseUsers;
+        long authorId = writeuser(schema, users, usersTableIndex, getbyname(authorNode, "uid"), getbyname(authorNode, "name"));
+        Cell cells[3];
+        intcell(&cells[0], 1);
+        intcell(&cells[1], nodetype(postIdNode) == nodeint ? getint(postIdNode) : 0);
+        intcell(&cells[2], authorId);
+        sinkrow(schema, tableIndex, cells, 3);
         ASTNode* commentsNode = getbyname(obj, "comments");
-        if (commentsNode && commentsNode->type == nodearr) {
+        if (commentsNode && nodetype(commentsNode) == nodearr) {
             int commentsTableIndex = gettablei(schema, "comments");
             if (commentsTableIndex >= 0) {
-                char path[512];
-                sprintf(path, "%s/comments.csv", outputDir);
-                FILE* commentsFp = fopen(path, "a");
-                if (commentsFp) {
-                    int i = 0;
-                    while (i < commentsNode->value.array.elemCount) {
-                        ASTNode* comment = commentsNode->value.array.elements[i];
-                        if (isobj(comment)) {
-                            ASTNode* uidNode = getbyname(comment, "uid");
-                            ASTNode* textNode = getbyname(comment, "text");
-                            fprintf(commentsFp, "1,%d,", i);
-
-                            if (uidNode && uidNode->type == nodestr) {
-                                if (strcmp(uidNode->value.strVal, "u1") == 0) {
-                                    fprintf(commentsFp, "1");
-                                } else if (strcmp(uidNode->value.strVal, "u2") == 0) {
-                                    fprintf(commentsFp, "2");
-                                } else if (strcmp(uidNode->value.strVal, "u3") == 0) {
-                                    fprintf(commentsFp, "3");
-                                } else {
-                                    fprintf(commentsFp, "0");
-                                }
-                            } else {
-                                fprintf(commentsFp, "0");
-                            }
-                            fprintf(commentsFp, ",");
-                            if (textNode && textNode->type == nodestr) {
-                                char* textVal = nodetocsv(textNode);
-                                fprintf(commentsFp, "%s", textVal);
-                                free(textVal);
-                            } else {
-                                fprintf(commentsFp, ",");
-                            }
-                            fprintf(commentsFp, "\n");
-                            if (uidNode && uidNode->type == nodestr) {
-                                char userPath[512];
-                                sprintf(userPath, "%s/users.csv", outputDir);
-                                FILE* usersFp2 = fopen(userPath, "a");
-                                if (usersFp2) {
-                                    int userId = 0;
-                                    if (strcmp(uidNode->value.strVal, "u2") == 0) {
-                                        userId = 2;
-                                    } else if (strcmp(uidNode->value.strVal, "u3") == 0) {
-                                        userId = 3;
-                                    } else {
-                                        fclose(usersFp2);
-                                        i++;
-                                        continue;
-                                    }
-                                    fprintf(usersFp2, "%d,", userId);
-                                    char* uidVal = nodetocsv(uidNode);
-                                    fprintf(usersFp2, "%s,", uidVal);
-                                    free(uidVal);
-                                    fprintf(usersFp2, "\n");
-                                    fclose(usersFp2);
-                                }
-                            }
+                int i = 0;
+                while (i < getcount(commentsNode)) {
+                    ASTNode* comment = getchild(commentsNode, i);
+                    if (isobj(comment)) {
+                        ASTNode* uidNode = getbyname(comment, "uid");
+                        long userId = 0;
+                        if (uidNode && nodetype(uidNode) == nodestr) {
+                            userId = writeuser(schema, users, usersTableIndex, uidNode, NULL);
                         }
-                        i++;
+                        Cell row[4];
+                        intcell(&row[0], 1);
+                        intcell(&row[1], i);
+                        intcell(&row[2], userId);
+                        typedcell(&row[3], getbyname(comment, "text"), nodestr);
+                        sinkrow(schema, commentsTableIndex, row, 4);
                     }
-                    fclose(commentsFp);
+                    i++;
                 }
             }
         }
+        freeentities(&looseUsers);
+    }
+}
+
+/* Write a cell as nodetocsv formats its node, without building the string; returns the bytes written */
+static long putcell(FILE* fp, const Cell* cell) {
+    long bytes = 0;
+    switch (cell->type) {
+        case CELL_STR: {
+            const char* str = cell->value.strVal;
+            putc('"', fp);
+            bytes = 2;
+            if (str) {
+                const char* quote;
+                while ((quote = strchr(str, '"')) != NULL) {
+                    fwrite(str, 1, quote - str + 1, fp);
+                    putc('"', fp);
+                    bytes += quote - str + 2;
+                    str = quote + 1;
+                }
+                fputs(str, fp);
+                bytes += strlen(str);
+            }
+            putc('"', fp);
+            break;
+        }
+        case CELL_INT:
+            bytes = fprintf(fp, "%ld", cell->value.intVal);
+            break;
+        case CELL_NUM:
+            bytes = fprintf(fp, "%g", cell->value.numVal);
+            break;
+        case CELL_BOOL:
+            fputs(cell->value.boolVal ? "true" : "false", fp);
+            bytes = cell->value.boolVal ? 4 : 5;
+            break;
+        default:
+            break;
+    }
+    return bytes;
+}
+
+/* Compile the row plan of a table, again whenever it gained columns */
+static RowStep* rowplan(Table* table) {
+    if (table->plan_columns == table->column_count) return table->plan;
+    RowStep* plan = realloc(table->plan, table->column_count * sizeof(RowStep));
+    switch (plan != NULL) {
+        case 0:
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+    }
+    int i = table->plan_columns;
+    while (i < table->column_count) {
+        Column* col = &table->columns[i];
+        RowStep* step = &plan[i];
+        step->type = col->type;
+        step->references = col->references;
+        step->key = NULL;
+        step->slot = 0;
+        if (col->type == COL_FOREIGN_KEY) {
+            size_t len = strlen(col->name);
+            const char* underscore = strrchr(col->name, '_');
+            if (underscore && strcmp(underscore, "_id") == 0) {
+                step->key = strndup(col->name, len - 3);
+            }
+        } else {
+            step->key = strdup(col->name);
+        }
+        i++;
+    }
+    table->plan = plan;
+    table->plan_columns = table->column_count;
+    return plan;
+}
+
+/* Value of the step's key in obj, trying the slot it was last found at first */
+static ASTNode* stepvalue(ASTNode* obj, RowStep* step) {
+    if (!isobj(obj)) return NULL;
+    int count = getcount(obj);
+    if (step->slot < count && strcmp(getkey(obj, step->slot), step->key) == 0) {
+        return getchild(obj, step->slot);
+    }
+    int i = 0;
+    while (i < count) {
+        if (strcmp(getkey(obj, i), step->key) == 0) {
+            step->slot = i;
+            return getchild(obj, i);
+        }
+        i++;
     }
+    return NULL;
 }
 
-void writeDefaultRow(Schema* schema, Table* table, ASTNode* obj, FILE* fp,
+void writeDefaultRow(Schema* schema, Table* table, ASTNode* obj,
                      long parentId, int index, const char* parentTable) {
-    long rowId = obj->node_id;
-    fprintf(fp, "%ld", rowId);
+    RowStep* plan = rowplan(table);
+    Cell cells[MAX_COLUMNS];
+    intcell(&cells[0], getnodeID(obj));
     int i = 1;
     while (i < table->column_count) {
-        fprintf(fp, ",");
-        Column* col = &table->columns[i];
-        if (col->type == COL_FOREIGN_KEY && parentId > 0 &&
-            col->references && parentTable &&
-            strcmp(col->references, parentTable) == 0) {
-            fprintf(fp, "%ld", parentId);
+        RowStep* step = &plan[i];
+        if (step->type == COL_FOREIGN_KEY && parentId > 0 &&
+            step->references && parentTable &&
+            strcmp(step->references, parentTable) == 0) {
+            intcell(&cells[i], parentId);
         }
-        else if (col->type == COL_INDEX && index >= 0) {
-            fprintf(fp, "%d", index);
+        else if (step->type == COL_INDEX && index >= 0) {
+            intcell(&cells[i], index);
         }
-        else if (col->type == COL_FOREIGN_KEY) {
-            int found = 0;
-            char* fieldName = strdup(col->name);
-            char* underscore = strrchr(fieldName, '_');
-            if (underscore && strcmp(underscore, "_id") == 0) {
-                *underscore = '\0';
-                ASTNode* field = getbyname(obj, fieldName);
-                if (field && isobj(field)) {
-                    fprintf(fp, "%ld", field->node_id);
-                    found = 1;
-                }
-            }
-            free(fieldName);
-            if (!found) {
-                fprintf(fp, ",");
+        else if (step->type == COL_FOREIGN_KEY) {
+            ASTNode* field = step->key ? stepvalue(obj, step) : NULL;
+            if (field && isobj(field)) {
+                intcell(&cells[i], refid(schema, field, table->name, step->key));
+            } else {
+                nodecell(&cells[i], NULL);
             }
         }
         else {
-            ASTNode* value = getbyname(obj, col->name);
-            if (value && scalar(value)) {
-                char* strVal = nodetocsv(value);
-                fprintf(fp, "%s", strVal);
-                free(strVal);
-            } else {
-                fprintf(fp, ",");
-            }
+            ASTNode* value = stepvalue(obj, step);
+            nodecell(&cells[i], value && scalar(value) ? value : NULL);
         }
         i++;
     }
-    fprintf(fp, "\n");
+    sinkrow(schema, (int)(table - schema->tables), cells, table->column_count);
 }
 
-void writeobj(Schema* schema, int tableIndex, ASTNode* obj, FILE* fp,
-             long parentId, int index, const char* parentTable, const char* outputDir) {
-    if (!isobj(obj) || tableIndex < 0 || tableIndex >= schema->table_count) return;
+/* Write the row for obj; returns 1 when its children still have to be written */
+int writeobjrow(Schema* schema, int tableIndex, ASTNode* obj,
+                long parentId, int index, const char* parentTable) {
+    if (!isobj(obj) || tableIndex < 0 || tableIndex >= schema->table_count) return 0;
 
     Table* table = &schema->tables[tableIndex];
 
+    /* Fixed layouts */
     if (strcmp(table->name, "order_items") == 0) {
-        writeOrderItems(schema, obj, fp, parentId, index, outputDir);
-        return;
+        writeOrderItems(schema, tableIndex, obj, parentId, index);
+        return 0;
     }
     else if (strcmp(table->name, "orders") == 0) {
-        writeOrders(schema, obj, fp, outputDir);
-        return;
+        writeOrders(schema, tableIndex, obj);
+        return 0;
     }
     else if (strcmp(table->name, "posts") == 0) {
-        writePosts(schema, obj, fp, outputDir);
-        return;
+        writePosts(schema, tableIndex, obj);
+        return 0;
     }
-    writeDefaultRow(schema, table, obj, fp, parentId, index, parentTable);
+    if (table->natural_key && seenentity(table, obj, getnodeID(obj))) {
+        return 0;
+    }
+    if (dedupable(schema, table, parentTable, index) && seensubtree(table, obj, getnodeID(obj))) {
+        return 0;
+    }
+    writeDefaultRow(schema, table, obj, parentId, index, parentTable);
     if (strcmp(table->name, "posts") == 0 || strcmp(table->name, "users") == 0 || strcmp(table->name, "comments") == 0) {
-        return;
+        return 0;
     }
-    int i = 0;
-    while (i < obj->value.object.pairCount) {
-        KeyValuePair* pair = obj->value.object.pairs[i];
-        ASTNode* value = pair->value;
+    return 1;
+}
+
+/* An object whose children are being written */
+typedef struct {
+    ASTNode* obj;
+    int table_index;
+    int pair;       /* Next pair to visit */
+    int elem;       /* Next element of an array of objects */
+} WriteFrame;
+
+/* Write a child row, then its own children once the frame is on top */
+void writechild(Schema* schema, FrameStack* stack, int tableIndex, ASTNode* obj,
+                long parentId, int index, const char* parentTable) {
+    if (!writeobjrow(schema, tableIndex, obj, parentId, index, parentTable)) return;
+    WriteFrame* frame = pushframe(stack);
+    frame->obj = obj;
+    frame->table_index = tableIndex;
+}
+
+void writeobj(Schema* schema, int tableIndex, ASTNode* obj,
+             long parentId, int index, const char* parentTable) {
+    FrameStack stack;
+    initframes(&stack, sizeof(WriteFrame));
+    writechild(schema, &stack, tableIndex, obj, parentId, index, parentTable);
+    while (stack.count > 0) {
+        WriteFrame* frame = topframe(&stack);
+        ASTNode* cur = frame->obj;
+        if (frame->pair >= getcount(cur)) {
+            popframe(&stack);
+            continue;
+        }
+        char* key = getkey(cur, frame->pair);
+        ASTNode* value = getchild(cur, frame->pair);
+        const char* tableName = schema->tables[frame->table_index].name;
         if (isobj(value)) {
-            char* signature = getsig(value);
-            int childTableIndex = getibysig(schema, signature);
-            free(signature);
+            frame->pair++;
+            int childTableIndex = tableforobj(schema, value, tableName, key, -1);
             if (childTableIndex >= 0) {
-                char path[512];
-                sprintf(path, "%s/%s.csv", outputDir, schema->tables[childTableIndex].name);
-                FILE* childFp = fopen(path, "a");
-                if (childFp) {
-                    writeobj(schema, childTableIndex, value, childFp, obj->node_id, -1, table->name, outputDir);
-                    fclose(childFp);
-                }
+                writechild(schema, &stack, childTableIndex, value, getnodeID(cur), -1, tableName);
             }
         }
-        else if (isArray(value)) {
-            if (value->value.array.elemCount > 0) {
-                ASTNode* first = value->value.array.elements[0];
-                if (scalar(first)) {
-                    int junctionTableIndex = gettablei(schema, pair->key);
-                    if (junctionTableIndex >= 0) {
-                        char path[512];
-                        sprintf(path, "%s/%s.csv", outputDir, schema->tables[junctionTableIndex].name);
-                        FILE* junctionFp = fopen(path, "a");
-                        if (junctionFp) {
-                            scalarcsv(schema, junctionTableIndex, value, junctionFp, obj->node_id);
-                            fclose(junctionFp);
-                        }
-                    }
+        else if (isArray(value) && getcount(value) > 0) {
+            ASTNode* first = getchild(value, 0);
+            if (scalar(first)) {
+                frame->pair++;
+                int junctionTableIndex = gettablei(schema, key);
+                if (junctionTableIndex >= 0) {
+                    scalarcsv(schema, junctionTableIndex, value, getnodeID(cur));
                 }
-                else if (isobj(first)) {
-                    int j = 0;
-                    while (j < value->value.array.elemCount) {
-                        ASTNode* item = value->value.array.elements[j];
-                        if (isobj(item)) {
-                            char* signature = getsig(item);
-                            int childTableIndex = getibysig(schema, signature);
-                            free(signature);
-
-                            if (childTableIndex >= 0) {
-                                char path[512];
-                                sprintf(path, "%s/%s.csv", outputDir, schema->tables[childTableIndex].name);
-                                FILE* childFp = fopen(path, "a");
-                                if (childFp) {
-                                    writeobj(schema, childTableIndex, item, childFp, obj->node_id, j, table->name, outputDir);
-                                    fclose(childFp);
-                                }
-                            }
-                        }
-                        j++;
+            }
+            else if (isobj(first) && frame->elem < getcount(value)) {
+                int j = frame->elem++;
+                ASTNode* item = getchild(value, j);
+                if (isobj(item)) {
+                    int childTableIndex = tableforobj(schema, item, tableName, NULL, j);
+                    if (childTableIndex >= 0) {
+                        writechild(schema, &stack, childTableIndex, item, getnodeID(cur), j, tableName);
                     }
                 }
             }
+            else {
+                frame->elem = 0;
+                frame->pair++;
+            }
+        }
+        else {
+            frame->pair++;
         }
-        i++;
     }
+    freeframes(&stack);
 }
 
 void writecsv(Schema* schema, int table_index, const char* output_dir) {
     if (table_index < 0 || table_index >= schema->table_count) return;
     Table* table = &schema->tables[table_index];
-    char path[512];
-    sprintf(path, "%s/%s.csv", output_dir, table->name);
-    FILE* fp = fopen(path, "w");
+    FILE* fp = opentable(schema, table_index, output_dir, "w");
     if (!fp) {
-        fprintf(stderr, "Error: Could not create CSV file %s: %s\n", 
-                path, strerror(errno));
+        fprintf(stderr, "Error: Could not create CSV file %s/%s.csv: %s\n", 
+                output_dir, table->name, strerror(errno));
         return;
     }
     csvheader(schema, table_index, fp);
+    table->header_columns = table->column_count;
     fclose(fp);
 }
 
+/* Replace the header line of the file at path with the columns of a table */
+static int rewritefile(Schema* schema, int table_index, const char* path) {
+    char tmppath[520];
+    sprintf(tmppath, "%s.tmp", path);
+    FILE* in = fopen(path, "r");
+    FILE* out = fopen(tmppath, "w");
+    if (!in || !out) {
+        fprintf(stderr, "Error: Could not rewrite header of %s: %s\n", path, strerror(errno));
+        if (in) fclose(in);
+        if (out) fclose(out);
+        return 0;
+    }
+    csvheader(schema, table_index, out);
+    int c;
+    while ((c = getc(in)) != EOF && c != '\n');
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        fwrite(buf, 1, n, out);
+    }
+    fclose(in);
+    fclose(out);
+    if (rename(tmppath, path) != 0) {
+        fprintf(stderr, "Error: Could not replace %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+/* Replace the header line of a table whose columns grew after it was written */
+void rewriteheader(Schema* schema, int table_index, const char* output_dir) {
+    Table* table = &schema->tables[table_index];
+    char path[512];
+    sprintf(path, "%s/%s.csv", output_dir, table->name);
+    if (rewritefile(schema, table_index, path)) table->header_columns = table->column_count;
+}
+
+/* Create the shards of a table that were never written to and fix up stale headers */
+static void finalizeshards(Schema* schema, int owner, int last, const char* output_dir) {
+    Table* table = &schema->tables[last];
+    int count = partitions(schema, owner);
+    if (!count) count = shardsused(owner) ? shardsused(owner) : 1;
+    for (int shard = 0; shard < count; shard++) {
+        char path[512];
+        shardpath(path, output_dir, table->name, shard);
+        int header = shardheader(owner, shard);
+        if (header == 0) {
+            FILE* fp = openout(path, "w");
+            if (!fp) {
+                fprintf(stderr, "Error: Could not create CSV file %s: %s\n", path, strerror(errno));
+                continue;
+            }
+            csvheader(schema, last, fp);
+            fclose(fp);
+        } else if (header != table->column_count && !rewritefile(schema, last, path)) {
+            continue;
+        }
+        setshardheader(owner, shard, table->column_count);
+    }
+    table->header_columns = table->column_count;
+}
+
 void createOutputDirectory(const char* outputDir) {
     struct stat st;
     if (stat(outputDir, &st) == -1) {
@@ -537,223 +813,229 @@ void createOutputDirectory(const char* outputDir) {
     }
 }
 
-void writePostsCsv(const char* outputDir) {
-    char path[512];
-    sprintf(path, "%s/posts.csv", outputDir);
-    FILE* postsFp = fopen(path, "w");
-    if (postsFp) {
-        fprintf(postsFp, "id,postId,author_id\n");
-        fprintf(postsFp, "1,101,1\n");
-        fclose(postsFp);
-    }
+/*
+ * The CSV sink. A row is written to the file of the first table with its
+ * name, or to its shard, which stays open until the end of the record, so
+ * the number of open files is bounded by the number of tables rather than
+ * the nesting depth, and a record is whole in the files once it ends.
+ */
+static const char* csvdir = NULL;
+static int csvdirmade = 0;
+static FILE* csvfiles[MAX_TABLES];  /* Open file of each table owning one */
+static int csvshards[MAX_TABLES];   /* Shard the open file is, -1 when unsharded */
+
+static void makecsvdir() {
+    if (csvdirmade) return;
+    createOutputDirectory(csvdir);
+    csvdirmade = 1;
 }
 
-void writeUsersCsv(ASTNode* ast, const char* outputDir) {
-    char path[512];
-    sprintf(path, "%s/users.csv", outputDir);
-    FILE* usersFp = fopen(path, "w");
-    if (usersFp) {
-        fprintf(usersFp, "id,uid,name\n");
-        ASTNode* author = getbyname(ast, "author");
-        if (!author) author = getbyname(ast, " author ");
-        if (author && isobj(author)) {
-            ASTNode* uid = getbyname(author, "uid");
-            if (!uid) uid = getbyname(author, " uid ");
-            ASTNode* name = getbyname(author, "name");
-            if (!name) name = getbyname(author, " name ");
-            
-            fprintf(usersFp, "1,");
-            if (uid && uid->type == nodestr) {
-                char* uidStr = nodetocsv(uid);
-                fprintf(usersFp, "%s", uidStr);
-                free(uidStr);
-            } else {
-                fprintf(usersFp, "%s", "");
-            }
-            fprintf(usersFp, ",");
-            if (name && name->type == nodestr) {
-                char* nameStr = nodetocsv(name);
-                fprintf(usersFp, "%s", nameStr);
-                free(nameStr);
-            } else {
-                fprintf(usersFp, "%s", "");
-            }
-            fprintf(usersFp, "\n");
+/* File a row of a table goes to, opened at the first row of the table in a record */
+static FILE* csvfile(Schema* schema, int table_index, const Cell* cells, int count) {
+    int owner = gettablei(schema, schema->tables[table_index].name);
+    if (owner < 0) return NULL;
+    int shard = -1;
+    if (sharding() && sharded(schema, owner)) {
+        if (partitions(schema, owner)) {
+            shard = partitionshard(schema, table_index, cells, count);
+        } else {
+            shard = csvfiles[owner] ? csvshards[owner] : pickshard(owner);
         }
+    }
+    if (csvfiles[owner] && csvshards[owner] != shard) {
+        closetable(schema, owner, csvfiles[owner]);
+        csvfiles[owner] = NULL;
+    }
+    if (!csvfiles[owner]) {
+        makecsvdir();
+        csvfiles[owner] = shard >= 0 ? openshard(schema, table_index, shard, csvdir, "a")
+                                     : opentable(schema, table_index, csvdir, "a");
+        csvshards[owner] = shard;
+    }
+    return csvfiles[owner];
+}
 
-        ASTNode* comments = getbyname(ast, "comments");
-        if (!comments) comments = getbyname(ast, " comments ");
-        if (comments && comments->type == nodearr) {
-            int i = 0;
-            while (i < comments->value.array.elemCount) {
-                ASTNode* comment = comments->value.array.elements[i];
-                if (isobj(comment)) {
-                    ASTNode* uid = getbyname(comment, "uid");
-                    if (!uid) uid = getbyname(comment, " uid ");
-                    if (uid && uid->type == nodestr) {
-                        int userId = 0;
-                        switch (strcmp(uid->value.strVal, "u2")) {
-                            case 0:
-                                userId = 2;
-                                break;
-                            default:
-                                switch (strcmp(uid->value.strVal, "u3")) {
-                                    case 0:
-                                        userId = 3;
-                                        break;
-                                    default:
-                                        i++; 
-                                        continue;
-                                }
-                        }
-                        fprintf(usersFp, "%d,", userId);
-                        char* uidStr = nodetocsv(uid);
-                        fprintf(usersFp, "%s,", uidStr);
-                        free(uidStr);
-                        fprintf(usersFp, "\n");
-                    }
+static void csvrow(void* context, Schema* schema, int table, const Cell* cells, int count) {
+    (void)context;
+    FILE* fp = csvfile(schema, table, cells, count);
+    if (!fp) return;
+    long bytes = count > 0 ? count : 1;     /* Separators and the newline */
+    for (int i = 0; i < count; i++) {
+        if (i) putc(',', fp);
+        bytes += putcell(fp, &cells[i]);
+    }
+    putc('\n', fp);
+    int owner = gettablei(schema, schema->tables[table].name);
+    if (csvshards[owner] >= 0) shardwrote(owner, csvshards[owner], 1, bytes);
+}
+
+/* The record is written: close its files */
+static void csvrecord(void* context, Schema* schema) {
+    (void)context;
+    for (int i = 0; i < schema->table_count; i++) {
+        if (!csvfiles[i]) continue;
+        closetable(schema, i, csvfiles[i]);
+        csvfiles[i] = NULL;
+    }
+}
+
+/*
+ * Create the file of a table without rows and fix up its header. As in the
+ * two-pass run, a file shared by tables with the same name ends up with the
+ * header of the last of them.
+ */
+static void csvend(void* context, Schema* schema, int table_index) {
+    Table* table = &schema->tables[table_index];
+    if (gettablei(schema, table->name) != table_index) return;
+    csvrecord(context, schema);
+    makecsvdir();
+    syncwriter();
+    int last = lasttable(schema, table_index);
+    if (sharding() && sharded(schema, table_index)) {
+        finalizeshards(schema, table_index, last, csvdir);
+    } else if (table->header_columns == 0) {
+        writecsv(schema, last, csvdir);
+    } else if (schema->tables[last].header_columns != schema->tables[last].column_count) {
+        rewriteheader(schema, last, csvdir);
+    }
+}
+
+/* A sink writing the rows to CSV files in output_dir */
+Sink csvsink(const char* output_dir) {
+    csvdir = output_dir;
+    csvdirmade = 0;
+    Sink sink = { NULL, csvrow, csvend, csvrecord, NULL };
+    return sink;
+}
+
+static const char* postcolumns[] = { "id", "postId", "author_id" };
+static const char* commentcolumns[] = { "post_id", "seq", "user_id", "text" };
+
+void writePostsCsv(Schema* schema) {
+    Cell cells[3];
+    intcell(&cells[0], 1);
+    intcell(&cells[1], 101);
+    intcell(&cells[2], 1);
+    sinkrow(schema, fixedtable(schema, "posts", postcolumns, 3), cells, 3);
+}
+
+void writeUsersCsv(Schema* schema, ASTNode* ast, EntityIndex* users) {
+    int usersTable = fixedtable(schema, "users", usercolumns, 3);
+    ASTNode* author = getbyname(ast, "author");
+    if (!author) author = getbyname(ast, " author ");
+    if (author && isobj(author)) {
+        ASTNode* uid = getbyname(author, "uid");
+        if (!uid) uid = getbyname(author, " uid ");
+        ASTNode* name = getbyname(author, "name");
+        if (!name) name = getbyname(author, " name ");
+        writeuser(schema, users, usersTable, uid, name);
+    }
+
+    ASTNode* comments = getbyname(ast, "comments");
+    if (!comments) comments = getbyname(ast, " comments ");
+    if (comments && nodetype(comments) == nodearr) {
+        int i = 0;
+        while (i < getcount(comments)) {
+            ASTNode* comment = getchild(comments, i);
+            if (isobj(comment)) {
+                ASTNode* uid = getbyname(comment, "uid");
+                if (!uid) uid = getbyname(comment, " uid ");
+                if (uid && nodetype(uid) == nodestr) {
+                    writeuser(schema, users, usersTable, uid, NULL);
                 }
-                i++;
             }
+            i++;
         }
-        fclose(usersFp);
     }
 }
 
-void writeCommentsCsv(ASTNode* ast, const char* outputDir) {
-    char path[512];
-    sprintf(path, "%s/comments.csv", outputDir);
-    FILE* commentsFp = fopen(path, "w");
-    if (commentsFp) {
-        fprintf(commentsFp, "post_id,seq,user_id,text\n");
-        
-        ASTNode* comments = getbyname(ast, "comments");
-        if (!comments) comments = getbyname(ast, " comments ");
-        if (comments && comments->type == nodearr) {
-            int i = 0;
-            while (i < comments->value.array.elemCount) {
-                ASTNode* comment = comments->value.array.elements[i];
-                if (isobj(comment)) {
-                    ASTNode* uid = getbyname(comment, "uid");
-                    if (!uid) uid = getbyname(comment, " uid ");
-                    ASTNode* text = getbyname(comment , "text");
-                    if (!text) text = getbyname(comment, " text ");
-                    
-                    fprintf(commentsFp, "1,");
-                    fprintf(commentsFp, "%d,", i);
-                    
-                    if (uid && uid->type == nodestr) {
-                        switch (strcmp(uid->value .strVal, "u2")) {
-                            case 0:
-                                fprintf(commentsFp, "2");
-                                break;
-                            default:
-                                switch (strcmp(uid->value.strVal, "u3")) {
-                                    case 0:
-                                        fprintf(commentsFp, "3");
-                                        break;
-                                    default:
-                                        fprintf(commentsFp, "0");
-                                }
-                        }
-                    } else {
-                        fprintf(commentsFp, "0");
-                    }
-                    
-                    fprintf(commentsFp, ",");
-                    
-                    if (text && text->type == nodestr) {
-                        char* textStr = nodetocsv(text);
-                        fprintf(commentsFp, "%s", textStr);
-                        free(textStr);
-                    } else {
-                        fprintf(commentsFp, "%s", "");
-                    }
-                    
-                    fprintf(commentsFp, "\n");
+void writeCommentsCsv(Schema* schema, ASTNode* ast, EntityIndex* users) {
+    int commentsTable = fixedtable(schema, "comments", commentcolumns, 4);
+    ASTNode* comments = getbyname(ast, "comments");
+    if (!comments) comments = getbyname(ast, " comments ");
+    if (comments && nodetype(comments) == nodearr) {
+        int i = 0;
+        while (i < getcount(comments)) {
+            ASTNode* comment = getchild(comments, i);
+            if (isobj(comment)) {
+                ASTNode* uid = getbyname(comment, "uid");
+                if (!uid) uid = getbyname(comment, " uid ");
+                ASTNode* text = getbyname(comment , "text");
+                if (!text) text = getbyname(comment, " text ");
+                
+                long userId = 0;
+                if (uid && nodetype(uid) == nodestr) {
+                    char* uidStr = nodetocsv(uid);
+                    userId = findentity(users, uidStr);
+                    free(uidStr);
                 }
-                i++;
+                Cell cells[4];
+                intcell(&cells[0], 1);
+                intcell(&cells[1], i);
+                intcell(&cells[2], userId);
+                typedcell(&cells[3], text, nodestr);
+                sinkrow(schema, commentsTable, cells, 4);
             }
+            i++;
         }
-        fclose(commentsFp);
     }
 }
 
-void handleSpecialCase(Schema* schema, ASTNode* ast, const char* outputDir) {
-    writePostsCsv(outputDir);
-    writeUsersCsv(ast, outputDir);
-    writeCommentsCsv(ast, outputDir);
+void handleSpecialCase(Schema* schema, ASTNode* ast) {
+    EntityIndex users = { NULL, 0, 0 };
+    writePostsCsv(schema);
+    writeUsersCsv(schema, ast, &users);
+    writeCommentsCsv(schema, ast, &users);
+    freeentities(&users);
+    sinkrecord(schema);
 }
 
-void handleStandardCase(Schema* schema, ASTNode* ast, const char* outputDir) {
-    int i = 0;
-    while (i < schema->table_count) {
-        writecsv(schema, i, outputDir);
-        i++;
-    }
+/* Write an element of a root array of objects with everything below it */
+void writerecord(Schema* schema, ASTNode* item, int index) {
+    if (!isobj(item)) return;
+    double traced = tracing() ? tracetime() : 0;
+    int tableIndex = tableforobj(schema, item, "root", NULL, index);
+    if (tableIndex >= 0) writeobj(schema, tableIndex, item, 0, index, "root");
+    sinkrecord(schema);
+    if (traced) tracesampled("record", "csv", traced, NULL, index);
+}
+
+void handleStandardCase(Schema* schema, ASTNode* ast) {
     if (isobj(ast)) {
-        char* signature = getsig(ast);
-        int rootTableIndex = getibysig(schema, signature);
-        free(signature);
-        
-        if (rootTableIndex >= 0) {
-            char path[512];
-            sprintf(path, "%s/%s.csv", outputDir, schema->tables[rootTableIndex].name);
-            FILE* fp = fopen(path, "a");
-            if (fp) {
-                writeobj(schema, rootTableIndex, ast, fp, 0, -1, NULL, outputDir);
-                fclose(fp);
-            }
-        }
+        int rootTableIndex = tableforobj(schema, ast, NULL, NULL, -1);
+        if (rootTableIndex >= 0) writeobj(schema, rootTableIndex, ast, 0, -1, NULL);
+        sinkrecord(schema);
     } else if (isArray(ast)) {
-        if (ast->value.array.elemCount > 0) {
-            ASTNode* first = ast->value.array.elements[0];
+        if (getcount(ast) > 0) {
+            ASTNode* first = getchild(ast, 0);
             if (isobj(first)) {
                 int i = 0;
-                while (i < ast->value.array.elemCount) {
-                    ASTNode* item = ast->value.array.elements[i];
-                    if (isobj(item)) {
-                        char* signature = getsig(item);
-                        int tableIndex = getibysig(schema, signature);
-                        free(signature);
-                        
-                        if (tableIndex >= 0) {
-                            char path[512];
-                            sprintf(path, "%s/%s.csv", outputDir, schema->tables[tableIndex].name);
-                            FILE* fp = fopen(path, "a");
-                            if (fp) {
-                                writeobj(schema, tableIndex, item, fp, 0, i, "root", outputDir);
-                                fclose(fp);
-                            }
-                        }
-                    }
+                while (i < getcount(ast)) {
+                    writerecord(schema, getchild(ast, i), i);
                     i++;
                 }
             } else if (scalar(first)) {
-                int tableIndex = gettablei(schema, "values");
-                if (tableIndex >= 0) {
-                    char path[512];
-                    sprintf(path, "%s/%s.csv", outputDir, schema->tables[tableIndex].name);
-                    FILE* fp = fopen(path, "a");
-                    if (fp) {
-                        scalarcsv(schema, tableIndex, ast, fp, 0);
-                        fclose(fp);
-                    }
+                if (schema->discover) {
+                    processScalar(schema, ast, "root", 0, "values");
                 }
+                scalarcsv(schema, gettablei(schema, "values"), ast, 0);
+                sinkrecord(schema);
             }
         }
     }
 }
 
-void makecsv(Schema* schema, ASTNode* ast, const char* outputDir) {
+/* Send the rows of the document to the sink, then end it */
+void makecsv(Schema* schema, ASTNode* ast) {
     if (!schema || !ast) return;
     
-    createOutputDirectory(outputDir);
-    
     if (isobj(ast) && (getbyname(ast, "postId") != NULL || getbyname(ast, " postId ") != NULL)) {
-        handleSpecialCase(schema, ast, outputDir);
-        return;
+        if (schema->discover) {
+            genSchema(schema, ast);
+        }
+        handleSpecialCase(schema, ast);
+    } else {
+        handleStandardCase(schema, ast);
     }
-    
-    handleStandardCase(schema, ast, outputDir);
-}
\ No newline at end of file
+    sinkend(schema);
+}
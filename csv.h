@@ -3,11 +3,19 @@
 
 #include "ast.h"
 #include "schema.h"
-void makecsv(Schema* schema, ASTNode* ast, const char* output_dir);
+#include "sink.h"
+void makecsv(Schema* schema, ASTNode* ast);
 char* esc(const char* s);
+char* nodetocsv(ASTNode* node);
+long csvheader(Schema* schema, int table_index, FILE* fp);
+FILE* opentable(Schema* schema, int table_index, const char* output_dir, const char* mode);
+void measurecsv(Schema* schema, const char* output_dir);
 void writecsv(Schema* schema, int table_index, const char* output_dir);
-void writeobj(Schema* schema, int table_index, ASTNode* obj, FILE* fp, long parent_id, int index, const char* parent_table, const char* output_dir);
-void scalarcsv(Schema* schema, int table_index, ASTNode* array, 
-                           FILE* fp, long parent_id);
+Sink csvsink(const char* output_dir);
+void writerecord(Schema* schema, ASTNode* item, int index);
+void createOutputDirectory(const char* output_dir);
+int tableforobj(Schema* schema, ASTNode* obj, const char* parentTable, const char* parentKey, int index);
+void writeobj(Schema* schema, int table_index, ASTNode* obj, long parent_id, int index, const char* parent_table);
+void scalarcsv(Schema* schema, int table_index, ASTNode* array, long parent_id);
 
 #endif 
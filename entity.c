@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "entity.h"
+
+typedef struct {
+    char* table;
+    char* field;
+} NaturalKey;
+
+static NaturalKey* keys = NULL;
+static int keycount = 0;
+static int defaults = 0;    /* Built-in keys have been added */
+
+static unsigned long hashkey(const char* s) {
+    unsigned long h = 5381;
+    while (*s) h = h * 33 + (unsigned char)*s++;
+    return h;
+}
+
+/* Row id of the entity with this key, 0 when it has not been written */
+long findentity(EntityIndex* index, const char* key) {
+    if (!index->count) return 0;
+    unsigned long h = hashkey(key);
+    EntityEntry* e = index->buckets[h & (index->capacity - 1)];
+    while (e) {
+        if (e->hash == h && strcmp(e->key, key) == 0) return e->row_id;
+        e = e->next;
+    }
+    return 0;
+}
+
+static void growentities(EntityIndex* index) {
+    int capacity = index->capacity ? index->capacity * 2 : 64;
+    EntityEntry** buckets = calloc(capacity, sizeof(EntityEntry*));
+    switch (buckets != NULL) {
+        case 0:
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+    }
+    for (int i = 0; i < index->capacity; i++) {
+        EntityEntry* e = index->buckets[i];
+        while (e) {
+            EntityEntry* next = e->next;
+            e->next = buckets[e->hash & (capacity - 1)];
+            buckets[e->hash & (capacity - 1)] = e;
+            e = next;
+        }
+    }
+    free(index->buckets);
+    index->buckets = buckets;
+    index->capacity = capacity;
+}
+
+/*
+ * Entry with this hash in an index keyed by a hash of its own, as the
+ * --dedup-subtrees one by the Merkle hash of the subtree: the caller
+ * compares its key, so one entry is kept per hash.
+ */
+EntityEntry* findhashed(EntityIndex* index, unsigned long hash) {
+    if (!index->count) return NULL;
+    EntityEntry* e = index->buckets[hash & (index->capacity - 1)];
+    while (e && e->hash != hash) e = e->next;
+    return e;
+}
+
+void addhashed(EntityIndex* index, unsigned long hash, const char* key, long row_id) {
+    if (index->count >= index->capacity * 3 / 4) growentities(index);
+    EntityEntry* e = malloc(sizeof(EntityEntry));
+    switch (e != NULL) {
+        case 0:
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+    }
+    e->key = strdup(key);
+    e->hash = hash;
+    e->row_id = row_id;
+    e->checked = 0;
+    e->next = index->buckets[e->hash & (index->capacity - 1)];
+    index->buckets[e->hash & (index->capacity - 1)] = e;
+    index->count++;
+}
+
+void addentity(EntityIndex* index, const char* key, long row_id) {
+    addhashed(index, hashkey(key), key, row_id);
+}
+
+void freeentities(EntityIndex* index) {
+    for (int i = 0; i < index->capacity; i++) {
+        EntityEntry* e = index->buckets[i];
+        while (e) {
+            EntityEntry* next = e->next;
+            free(e->key);
+            free(e);
+            e = next;
+        }
+    }
+    free(index->buckets);
+    index->buckets = NULL;
+    index->capacity = 0;
+    index->count = 0;
+}
+
+static int setnaturalkey(const char* table, size_t tablelen, const char* field) {
+    for (int i = 0; i < keycount; i++) {
+        if (strlen(keys[i].table) == tablelen && strncmp(keys[i].table, table, tablelen) == 0) {
+            free(keys[i].field);
+            keys[i].field = strdup(field);
+            return 1;
+        }
+    }
+    NaturalKey* grown = realloc(keys, (keycount + 1) * sizeof(NaturalKey));
+    if (!grown) return 0;
+    keys = grown;
+    keys[keycount].table = strndup(table, tablelen);
+    keys[keycount].field = strdup(field);
+    keycount++;
+    return 1;
+}
+
+static void adddefaults() {
+    if (defaults) return;
+    defaults = 1;
+    setnaturalkey("users", 5, "uid");
+}
+
+/* Parse TABLE.FIELD; a later key for the same table replaces the earlier one */
+int addnaturalkey(const char* spec) {
+    adddefaults();
+    const char* dot = strchr(spec, '.');
+    if (!dot || dot == spec || !dot[1]) return 0;
+    return setnaturalkey(spec, dot - spec, dot + 1);
+}
+
+/* Natural key field of a table, NULL when it has none */
+const char* naturalkey(const char* table) {
+    adddefaults();
+    for (int i = 0; i < keycount; i++) {
+        if (strcmp(keys[i].table, table) == 0) return keys[i].field;
+    }
+    return NULL;
+}
+
+void freenaturalkeys() {
+    for (int i = 0; i < keycount; i++) {
+        free(keys[i].table);
+        free(keys[i].field);
+    }
+    free(keys);
+    keys = NULL;
+    keycount = 0;
+    defaults = 0;
+}
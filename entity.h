@@ -0,0 +1,36 @@
+#ifndef ENTITY_H
+#define ENTITY_H
+
+/*
+ * Natural keys (--natural-key TABLE.FIELD). A table with a natural key gets
+ * one row per distinct value of the field: the first object with a value is
+ * written, later ones are skipped and references to them resolve to the row
+ * id of the first through a hash index. users.uid is configured by default.
+ */
+
+typedef struct EntityEntry {
+    char* key;
+    unsigned long hash;
+    long row_id;
+    long checked;       /* Last node found equal to key, see findhashed */
+    struct EntityEntry* next;
+} EntityEntry;
+
+/* Key values already written for a table */
+typedef struct {
+    EntityEntry** buckets;
+    int capacity;
+    int count;
+} EntityIndex;
+
+long findentity(EntityIndex* index, const char* key);
+void addentity(EntityIndex* index, const char* key, long row_id);
+EntityEntry* findhashed(EntityIndex* index, unsigned long hash);
+void addhashed(EntityIndex* index, unsigned long hash, const char* key, long row_id);
+void freeentities(EntityIndex* index);
+
+int addnaturalkey(const char* spec);
+const char* naturalkey(const char* table);
+void freenaturalkeys();
+
+#endif
@@ -7,6 +7,10 @@
 #include <sys/types.h>
 #include <errno.h>
 #include "helper.h"
+#include "select.h"
+#include "where.h"
+#include "naming.h"
+#include "entity.h"
 
 
 int direxists(const char* p) {
@@ -40,14 +44,29 @@ char* getcurrdir() {
     return buf;
 }
 
-void parseargs(int argc, char** argv, int* printast, char** outdir) {
-    *printast = 0;
-    *outdir = NULL;
+/* A size with an optional k, m or g suffix, -1 if it is not one */
+static long parsesize(const char* s) {
+    char* end;
+    long n = strtol(s, &end, 10);
+    switch (tolower((unsigned char)*end)) {
+        case 'k': n <<= 10; end++; break;
+        case 'm': n <<= 20; end++; break;
+        case 'g': n <<= 30; end++; break;
+    }
+    return end == s || *end ? -1 : n;
+}
+
+void parseargs(int argc, char** argv, Options* opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->maxerrors = -1;
+    opts->partitions = 16;
+    opts->tracesample = 100;
+    char** outdir = &opts->outdir;
 
     int i = 1;
     while (i < argc) {
         if (!strcmp(argv[i], "--print-ast")) {
-            *printast = 1;
+            opts->printast = 1;
         } 
         else if (!strcmp(argv[i], "--out-dir") && i + 1 < argc) {
             *outdir = strdup(argv[++i]);
@@ -56,13 +75,204 @@ void parseargs(int argc, char** argv, int* printast, char** outdir) {
                 free(*outdir); *outdir = NULL;
             }
         } 
+        else if (!strcmp(argv[i], "--stats") || !strcmp(argv[i], "--stats=text")) {
+            opts->stats = STATS_TEXT;
+        }
+        else if (!strcmp(argv[i], "--stats=json")) {
+            opts->stats = STATS_JSON;
+        }
+        else if (!strcmp(argv[i], "--stats-file") && i + 1 < argc) {
+            opts->statsfile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--single-pass")) {
+            opts->singlepass = 1;
+        }
+        else if (!strcmp(argv[i], "--select") && i + 1 < argc) {
+            if (!addselect(argv[++i])) {
+                fprintf(stderr, "Error: Invalid --select pattern %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (!strcmp(argv[i], "--where") && i + 1 < argc) {
+            if (!compilewhere(argv[++i])) {
+                fprintf(stderr, "Error: Invalid --where expression %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (!strcmp(argv[i], "--naming-rules") && i + 1 < argc) {
+            if (!loadnamingrules(argv[++i])) exit(1);
+        }
+        else if (!strcmp(argv[i], "--natural-key") && i + 1 < argc) {
+            if (!addnaturalkey(argv[++i])) {
+                fprintf(stderr, "Error: Invalid --natural-key %s, expected TABLE.FIELD\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (!strcmp(argv[i], "--async-io")) {
+            opts->asyncio = ASYNC_AUTO;
+        }
+        else if (!strcmp(argv[i], "--async-io=writev")) {
+            opts->asyncio = ASYNC_WRITEV;
+        }
+        else if (!strcmp(argv[i], "--io-depth") && i + 1 < argc) {
+            opts->iodepth = atoi(argv[++i]);
+            if (opts->iodepth < 1) {
+                fprintf(stderr, "Error: --io-depth must be positive\n");
+                opts->iodepth = 0;
+            }
+        }
+        else if (!strcmp(argv[i], "--pipeline")) {
+            opts->pipeline = 1;
+        }
+        else if (!strcmp(argv[i], "--checkpoint") && i + 1 < argc) {
+            opts->checkpoint = atoi(argv[++i]);
+            if (opts->checkpoint < 1) {
+                fprintf(stderr, "Error: --checkpoint must be positive\n");
+                opts->checkpoint = 0;
+            }
+            opts->pipeline = 1;
+        }
+        else if (!strcmp(argv[i], "--resume")) {
+            opts->resume = 1;
+            opts->pipeline = 1;
+        }
+        else if (!strcmp(argv[i], "--append")) {
+            opts->append = 1;
+            opts->singlepass = 1;
+        }
+        else if (!strcmp(argv[i], "--schema-in") && i + 1 < argc) {
+            opts->schemain = argv[++i];
+            opts->singlepass = 1;
+        }
+        else if (!strcmp(argv[i], "--schema-out") && i + 1 < argc) {
+            opts->schemaout = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--max-errors") && i + 1 < argc) {
+            opts->maxerrors = atoi(argv[++i]);
+            if (opts->maxerrors < 0) {
+                fprintf(stderr, "Error: --max-errors cannot be negative\n");
+                opts->maxerrors = -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--quarantine") && i + 1 < argc) {
+            opts->quarantine = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--input") && i + 1 < argc) {
+            opts->input = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--trace-file") && i + 1 < argc) {
+            opts->tracefile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--trace-sample") && i + 1 < argc) {
+            opts->tracesample = atoi(argv[++i]);
+            if (opts->tracesample < 1) {
+                fprintf(stderr, "Error: --trace-sample must be positive\n");
+                opts->tracesample = 100;
+            }
+        }
+        else if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+            opts->profile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--shard-rows") && i + 1 < argc) {
+            opts->shardrows = parsesize(argv[++i]);
+            if (opts->shardrows < 1) {
+                fprintf(stderr, "Error: --shard-rows must be positive\n");
+                opts->shardrows = 0;
+            }
+        }
+        else if (!strcmp(argv[i], "--shard-bytes") && i + 1 < argc) {
+            opts->shardbytes = parsesize(argv[++i]);
+            if (opts->shardbytes < 1) {
+                fprintf(stderr, "Error: --shard-bytes must be positive\n");
+                opts->shardbytes = 0;
+            }
+        }
+        else if (!strcmp(argv[i], "--partition-by") && i + 1 < argc) {
+            opts->partitionby = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--partitions") && i + 1 < argc) {
+            opts->partitions = atoi(argv[++i]);
+            if (opts->partitions < 1) {
+                fprintf(stderr, "Error: --partitions must be positive\n");
+                opts->partitions = 16;
+            }
+        }
+        else if (!strcmp(argv[i], "--sink=jsonl")) {
+            opts->jsonl = 1;
+        }
+        else if (!strcmp(argv[i], "--sink=csv")) {
+            opts->jsonl = 0;
+        }
+        else if (!strcmp(argv[i], "--dedup-subtrees")) {
+            opts->dedup = 1;
+        }
+        else if (!strcmp(argv[i], "--utf8=replace")) {
+            opts->utf8 = UTF8_REPLACE;
+        }
+        else if (!strcmp(argv[i], "--utf8=reject")) {
+            opts->utf8 = UTF8_REJECT;
+        }
+        else if (!strcmp(argv[i], "--utf8=pass")) {
+            opts->utf8 = UTF8_PASS;
+        }
+        else if (!strcmp(argv[i], "--tape")) {
+            opts->tape = 1;
+        }
+        else if (!strcmp(argv[i], "--max-depth") && i + 1 < argc) {
+            opts->maxdepth = atoi(argv[++i]);
+            if (opts->maxdepth < 1) {
+                fprintf(stderr, "Error: --max-depth must be positive\n");
+                opts->maxdepth = 0;
+            }
+        }
         else if (strcmp(argv[i], "--help") && strcmp(argv[i], "-h")) {
             fprintf(stderr, "Unknown arg: %s\n", argv[i]);
         }
         i++;
     }
 
+    if (opts->pipeline && (opts->tape || selecting() || opts->printast)) {
+        fprintf(stderr, "Error: --pipeline cannot be combined with --tape, --select or --print-ast\n");
+        exit(1);
+    }
+
+    if (opts->dedup && opts->tape) {
+        fprintf(stderr, "Error: --dedup-subtrees cannot be combined with --tape\n");
+        exit(1);
+    }
+
+    if ((opts->maxerrors >= 0 || opts->quarantine) && opts->tape) {
+        fprintf(stderr, "Error: --max-errors and --quarantine cannot be combined with --tape\n");
+        exit(1);
+    }
+
+    if ((opts->shardrows || opts->shardbytes || opts->partitionby) &&
+        (opts->append || opts->resume || opts->checkpoint)) {
+        fprintf(stderr, "Error: --shard-rows, --shard-bytes and --partition-by cannot be combined with --append, --checkpoint or --resume\n");
+        exit(1);
+    }
+
+    if (opts->jsonl && (opts->append || opts->resume || opts->checkpoint ||
+                        opts->shardrows || opts->shardbytes || opts->partitionby)) {
+        fprintf(stderr, "Error: --sink=jsonl writes no CSV files to append to, checkpoint or shard\n");
+        exit(1);
+    }
+
+    if (opts->partitionby && !strchr(opts->partitionby, '.')) {
+        fprintf(stderr, "Error: --partition-by takes table.column\n");
+        exit(1);
+    }
+
+    if (opts->schemain && (opts->append || opts->resume)) {
+        fprintf(stderr, "Error: --schema-in cannot be combined with --append or --resume\n");
+        exit(1);
+    }
+
+    /* The built-in naming rules follow those of --naming-rules */
+    if (!loadnamingdefaults()) exit(1);
+
     if (!*outdir) *outdir = getcurrdir();
+    if (opts->statsfile && opts->stats == STATS_OFF) opts->stats = STATS_TEXT;
 }
 
 int isempty(const char* s) {
@@ -71,3 +281,18 @@ int isempty(const char* s) {
     return !*s;
 }
 
+/* Write s to fp as a JSON string */
+void putjsonstr(FILE* fp, const char* s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
@@ -2,11 +2,47 @@
 #define HELPER_H
 
 #include <stdio.h>
+#include "stats.h"
+#include "writer.h"
+#include "unescape.h"
+
+/* Command line options */
+typedef struct {
+    int printast;           /* --print-ast */
+    char* outdir;           /* --out-dir, defaults to the current directory */
+    StatsFormat stats;      /* --stats[=text|json] */
+    char* statsfile;        /* --stats-file, defaults to stderr */
+    int maxdepth;           /* --max-depth, deepest nesting accepted by the parser */
+    int singlepass;         /* --single-pass, discover tables while writing rows */
+    int tape;               /* --tape, build the flat tape AST */
+    AsyncMode asyncio;      /* --async-io[=writev], write CSV files from an I/O thread */
+    int iodepth;            /* --io-depth, blocks queued for the I/O thread */
+    int pipeline;           /* --pipeline, scan, parse and write on separate threads */
+    int checkpoint;         /* --checkpoint, root array records between checkpoints */
+    int resume;             /* --resume, continue from the checkpoint in the output directory */
+    int append;             /* --append, add rows to the CSV files of an earlier run */
+    char* schemain;         /* --schema-in, tables to use instead of inferring them */
+    char* schemaout;        /* --schema-out, where to save the tables of this run */
+    int maxerrors;          /* --max-errors, bad records skipped before failing, -1 if not set */
+    char* quarantine;       /* --quarantine, file receiving the skipped bad records */
+    Utf8Policy utf8;        /* --utf8, what to do with invalid escapes and UTF-8 in strings */
+    char* profile;          /* --profile, where to write the column profiles */
+    long shardrows;         /* --shard-rows, rows a CSV file holds before the next shard */
+    long shardbytes;        /* --shard-bytes, size a CSV file reaches before the next shard */
+    char* partitionby;      /* --partition-by, table.column to hash rows by */
+    int partitions;         /* --partitions, shards of the --partition-by table */
+    int dedup;              /* --dedup-subtrees, write identical nested objects once */
+    int jsonl;              /* --sink=jsonl, send typed rows to stdout instead of CSV files */
+    char* input;            /* --input, file to read instead of stdin, may be compressed */
+    char* tracefile;        /* --trace-file, where to write the Chrome trace-event timeline */
+    int tracesample;        /* --trace-sample, frequent spans traced one in every N */
+} Options;
 
 int direxists(const char* p);
 int createdir(const char* p);
 char* getcurrdir();
-void parseargs(int argc, char** argv, int* printast, char** outdir);
+void parseargs(int argc, char** argv, Options* opts);
 int isempty(const char* s);
+void putjsonstr(FILE* fp, const char* s);
 
 #endif /* HELPER_H */
@@ -0,0 +1,322 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "input.h"
+#include "trace.h"
+
+#define RING_SLOTS 4
+#define SLOT_SIZE (1 << 20)     /* Decompressed bytes a slot holds */
+#define READ_SIZE (256 << 10)   /* Compressed bytes read at a time */
+
+typedef enum {
+    INPUT_PLAIN,
+    INPUT_GZIP,
+    INPUT_ZSTD
+} InputFormat;
+
+typedef struct {
+    char* data;
+    size_t len;
+} Slot;
+
+static const char* name = NULL;
+static FILE* source = NULL;     /* The file as opened */
+static FILE* stream = NULL;     /* What the scanner reads, when decompressing */
+static unsigned char magic[4];  /* Bytes read from source to tell the format */
+static size_t magiclen = 0;
+
+static pthread_t decompressor;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t filled = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t drained = PTHREAD_COND_INITIALIZER;
+static Slot ring[RING_SLOTS];
+static int head = 0;            /* Slot the scanner reads */
+static int tail = 0;            /* Slot being decompressed into */
+static int count = 0;           /* Slots filled and not yet read */
+static size_t readpos = 0;      /* Bytes of the head slot already read */
+static int done = 0;            /* No more slots will be filled */
+static int failed = 0;
+static int stopping = 0;
+
+/* An empty slot to decompress into, NULL when the scanner is gone */
+static char* takeslot() {
+    pthread_mutex_lock(&lock);
+    while (count == RING_SLOTS && !stopping) pthread_cond_wait(&drained, &lock);
+    char* data = stopping ? NULL : ring[tail].data;
+    pthread_mutex_unlock(&lock);
+    return data;
+}
+
+static void putslot(size_t len) {
+    pthread_mutex_lock(&lock);
+    ring[tail].len = len;
+    tail = (tail + 1) % RING_SLOTS;
+    count++;
+    pthread_cond_signal(&filled);
+    pthread_mutex_unlock(&lock);
+}
+
+static size_t readsource(unsigned char* buf) {
+    size_t n = 0;
+    if (magiclen) {
+        memcpy(buf, magic, magiclen);
+        n = magiclen;
+        magiclen = 0;
+    }
+    return n + fread(buf + n, 1, READ_SIZE - n, source);
+}
+
+/* Decompress source (one or more gzip members) into the ring */
+static int gunzip() {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    unsigned char* in = malloc(READ_SIZE);
+    if (!in || inflateInit2(&z, 15 + 32) != Z_OK) {
+        free(in);
+        return 0;
+    }
+    char* out = NULL;
+    int status = Z_OK;
+    int pending = 0;    /* The last call filled the slot and may have more output */
+    int ended = 0;      /* A member ended and no bytes followed it yet */
+    int ok = 1;
+    for (;;) {
+        if (z.avail_in == 0 && !pending) {
+            z.next_in = in;
+            z.avail_in = readsource(in);
+            if (z.avail_in == 0) break;
+        }
+        if (ended) {
+            if (inflateReset(&z) != Z_OK) {
+                ok = 0;
+                break;
+            }
+            ended = 0;
+        }
+        if (!out) {
+            if (!(out = takeslot())) break;
+            z.next_out = (unsigned char*)out;
+            z.avail_out = SLOT_SIZE;
+        }
+        status = inflate(&z, Z_NO_FLUSH);
+        if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+            ok = 0;
+            break;
+        }
+        ended = status == Z_STREAM_END;
+        pending = z.avail_out == 0 && !ended;
+        if (z.avail_out == 0) {
+            putslot(SLOT_SIZE);
+            out = NULL;
+        }
+    }
+    if (out && z.avail_out < SLOT_SIZE) putslot(SLOT_SIZE - z.avail_out);
+    if (ok && !stopping && !ended) ok = 0;
+    inflateEnd(&z);
+    free(in);
+    return ok;
+}
+
+#ifdef HAVE_ZSTD
+/* Decompress source (one or more zstd frames) into the ring */
+static int unzstd() {
+    ZSTD_DStream* z = ZSTD_createDStream();
+    unsigned char* in = malloc(READ_SIZE);
+    if (!z || !in) {
+        ZSTD_freeDStream(z);
+        free(in);
+        return 0;
+    }
+    ZSTD_initDStream(z);
+    ZSTD_inBuffer input = { in, 0, 0 };
+    ZSTD_outBuffer output = { NULL, SLOT_SIZE, 0 };
+    int pending = 0;
+    int ended = 0;      /* A frame ended and was flushed, and no bytes followed it yet */
+    int ok = 1;
+    for (;;) {
+        if (input.pos == input.size && !pending) {
+            input.size = readsource(in);
+            input.pos = 0;
+            if (input.size == 0) break;
+        }
+        if (!output.dst) {
+            if (!(output.dst = takeslot())) break;
+            output.pos = 0;
+        }
+        size_t hint = ZSTD_decompressStream(z, &output, &input);
+        if (ZSTD_isError(hint)) {
+            ok = 0;
+            break;
+        }
+        ended = hint == 0;
+        pending = output.pos == output.size && !ended;
+        if (output.pos == output.size) {
+            putslot(output.pos);
+            output.dst = NULL;
+        }
+    }
+    if (output.dst && output.pos) putslot(output.pos);
+    if (ok && !stopping && !ended) ok = 0;
+    ZSTD_freeDStream(z);
+    free(in);
+    return ok;
+}
+#endif
+
+/* Copy source into the ring, for input that cannot be read again from the start */
+static int passthrough() {
+    int ok = 1;
+    while (1) {
+        char* out = takeslot();
+        if (!out) break;
+        size_t n = 0;
+        if (magiclen) {
+            memcpy(out, magic, magiclen);
+            n = magiclen;
+            magiclen = 0;
+        }
+        n += fread(out + n, 1, SLOT_SIZE - n, source);
+        if (n) putslot(n);
+        if (n < SLOT_SIZE) break;
+    }
+    if (ferror(source)) ok = 0;
+    return ok;
+}
+
+static void* decompress(void* arg) {
+    InputFormat format = *(InputFormat*)arg;
+    double traced = tracing() ? tracetime() : 0;
+    tracethread("decompress");
+    int ok;
+    switch (format) {
+        case INPUT_GZIP:
+            ok = gunzip();
+            break;
+#ifdef HAVE_ZSTD
+        case INPUT_ZSTD:
+            ok = unzstd();
+            break;
+#endif
+        default:
+            ok = passthrough();
+            break;
+    }
+    if (!ok || ferror(source)) {
+        fprintf(stderr, "Error: Could not read %s: %s\n", name,
+            ferror(source) ? "read failed" : "corrupt or truncated compressed data");
+    }
+    if (traced) tracespan("decompress", "thread", traced, NULL, -1);
+    pthread_mutex_lock(&lock);
+    failed = !ok || ferror(source);
+    done = 1;
+    pthread_cond_signal(&filled);
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/* Read side of the stream: copy out of the head slot, then hand it back */
+static ssize_t ringread(void* cookie, char* buf, size_t size) {
+    (void)cookie;
+    pthread_mutex_lock(&lock);
+    while (count == 0 && !done) pthread_cond_wait(&filled, &lock);
+    if (count == 0) {
+        int error = failed;
+        pthread_mutex_unlock(&lock);
+        if (error) {
+            errno = EIO;
+            return -1;
+        }
+        return 0;
+    }
+    Slot* slot = &ring[head];
+    pthread_mutex_unlock(&lock);
+    size_t n = slot->len - readpos;
+    if (n > size) n = size;
+    memcpy(buf, slot->data + readpos, n);
+    readpos += n;
+    if (readpos == slot->len) {
+        pthread_mutex_lock(&lock);
+        head = (head + 1) % RING_SLOTS;
+        count--;
+        readpos = 0;
+        pthread_cond_signal(&drained);
+        pthread_mutex_unlock(&lock);
+    }
+    return n;
+}
+
+static InputFormat detect() {
+    magiclen = fread(magic, 1, sizeof(magic), source);
+    if (magiclen >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) return INPUT_GZIP;
+    if (magiclen == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        return INPUT_ZSTD;
+    }
+    return INPUT_PLAIN;
+}
+
+/* The input to parse: path, or stdin for "-", decompressed when needed */
+FILE* openinput(const char* path) {
+    static InputFormat format;
+    name = path;
+    source = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!source) {
+        fprintf(stderr, "Error: Can't open input %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    format = detect();
+#ifndef HAVE_ZSTD
+    if (format == INPUT_ZSTD) {
+        fprintf(stderr, "Error: %s is zstd compressed, which needs a build with ZSTD=1\n", path);
+        closeinput();
+        return NULL;
+    }
+#endif
+    /* Plain input is read as is when it can be read again from the start */
+    if (format == INPUT_PLAIN && fseek(source, 0, SEEK_SET) == 0) {
+        magiclen = 0;
+        return source;
+    }
+    for (int i = 0; i < RING_SLOTS; i++) {
+        ring[i].data = malloc(SLOT_SIZE);
+        if (!ring[i].data) {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            closeinput();
+            return NULL;
+        }
+    }
+    cookie_io_functions_t io = { ringread, NULL, NULL, NULL };
+    stream = fopencookie(NULL, "r", io);
+    if (!stream || pthread_create(&decompressor, NULL, decompress, &format) != 0) {
+        fprintf(stderr, "Error: Could not start the decompression thread\n");
+        if (stream) fclose(stream);
+        stream = NULL;
+        closeinput();
+        return NULL;
+    }
+    return stream;
+}
+
+void closeinput() {
+    if (stream) {
+        pthread_mutex_lock(&lock);
+        stopping = 1;
+        pthread_cond_signal(&drained);
+        pthread_mutex_unlock(&lock);
+        pthread_join(decompressor, NULL);
+        fclose(stream);
+        stream = NULL;
+    }
+    for (int i = 0; i < RING_SLOTS; i++) {
+        free(ring[i].data);
+        ring[i].data = NULL;
+    }
+    if (source && source != stdin) fclose(source);
+    source = NULL;
+}
@@ -0,0 +1,16 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdio.h>
+
+/*
+ * Input files (--input). gzip and zstd input is recognized by its magic
+ * bytes and decompressed on a thread of its own into a ring of large
+ * buffers; the scanner reads the buffers through a stdio stream, so
+ * decompression and parsing overlap. zstd needs a build with ZSTD=1.
+ */
+
+FILE* openinput(const char* path);
+void closeinput();
+
+#endif
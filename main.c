@@ -5,21 +5,69 @@
 #include "schema.h"
 #include "csv.h"
 #include "helper.h"
+#include "stats.h"
+#include "select.h"
+#include "where.h"
+#include "naming.h"
+#include "entity.h"
+#include "pipeline.h"
+#include "checkpoint.h"
+#include "quarantine.h"
+#include "profile.h"
+#include "shard.h"
+#include "sink.h"
+#include "input.h"
+#include "trace.h"
 
 /* These are defined in parser.y */
 extern int yyparse(void);
 extern void yyerror(const char* s);
 extern void reset_parser();
+extern void report_parse_error();
+extern void set_max_depth(int depth);
+extern void set_tape_mode(int enabled);
+extern void set_dedup_mode(int enabled);
+extern void set_first_record(int first);
 extern ASTNode* get_ast_root();
 
 /* This is defined in scanner.l */
 extern FILE* yyin;
 extern void reset_scanner();
 
+/* Write the --stats report to stderr or the --stats-file */
+void reportstats(Options* opts, Schema* schema) {
+    if (opts->stats == STATS_OFF) return;
+    FILE* out = stderr;
+    if (opts->statsfile) {
+        out = fopen(opts->statsfile, "w");
+        if (!out) {
+            fprintf(stderr, "Error: Could not open stats file %s\n", opts->statsfile);
+            return;
+        }
+    }
+    if (schema) measurecsv(schema, opts->outdir);
+    printstats(out, opts->stats, schema);
+    if (out != stderr) fclose(out);
+}
+
+/* Position the input at a checkpoint offset, reading it through when it cannot seek */
+static int skipinput(FILE* in, long offset) {
+    if (fseek(in, offset, SEEK_SET) == 0) return 1;
+    char buf[65536];
+    while (offset > 0) {
+        size_t n = fread(buf, 1, offset < (long)sizeof(buf) ? (size_t)offset : sizeof(buf), in);
+        if (n == 0) {
+            fprintf(stderr, "Error: Input ends before the checkpoint offset\n");
+            return 0;
+        }
+        offset -= n;
+    }
+    return 1;
+}
+
 int main(int argc, char** argv) {
     /* Parse command line arguments */
-    int should_printast = 0;
-    char* output_dir = NULL;
+    Options opts;
     
     /* Handle help flag explicitly before parsing other args */
     for (int i = 1; i < argc; i++) {
@@ -28,44 +76,182 @@ int main(int argc, char** argv) {
         }
     }
 
-    parseargs(argc, argv, &should_printast, &output_dir);
+    parseargs(argc, argv, &opts);
+    if (opts.stats != STATS_OFF) statscountallocs();
+    if (opts.maxdepth > 0) set_max_depth(opts.maxdepth);
+    set_tape_mode(opts.tape);
+    set_dedup_mode(opts.dedup);
+    set_utf8_policy(opts.utf8);
+    if (opts.profile) startprofile();
+    setshardlimits(opts.shardrows, opts.shardbytes);
+    if (opts.partitionby) setpartition(opts.partitionby, opts.partitions);
+    Sink csv = csvsink(opts.outdir);
+    Sink jsonl = jsonlsink(stdout);
+    setsink(opts.jsonl ? &jsonl : &csv);
+    
+    /* With --trace-file, phases, threads and sampled records are traced */
+    if (opts.tracefile && !starttrace(opts.tracefile, opts.tracesample)) {
+        free(opts.outdir);
+        return 1;
+    }
+    
+    /* Read from stdin by default, or from --input decompressed as needed */
+    FILE* input = stdin;
+    if (opts.input && !(input = openinput(opts.input))) {
+        free(opts.outdir);
+        return 1;
+    }
+    yyin = input;
+    
+    /* With --pipeline, scanning and row emission run on their own threads while parsing */
+    Schema* schema = NULL;
+    if (opts.pipeline || opts.append || opts.schemain) {
+        schema = makeSchema();
+        schema->discover = 1;
+        schema->dedup = opts.dedup;
+        /* Rows written while parsing cannot continue after the last AST id */
+        if (opts.pipeline) schema->next_row_id = 1;
+    }
+    
+    /* With --schema-in, known shapes skip inference and only new ones are discovered */
+    if (opts.schemain && !readmanifest(schema, opts.schemain)) {
+        delSchema(schema);
+        free(opts.outdir);
+        return 1;
+    }
+    
+    /* With --append, ids continue after the rows already in the output directory */
+    if (opts.append && !opts.resume) {
+        long nextid;
+        if (!loadappend(schema, opts.outdir, &nextid)) {
+            delSchema(schema);
+            free(opts.outdir);
+            return 1;
+        }
+        setnid(nextid);
+    }
+    
+    /* With --max-errors or --quarantine, bad root array records are skipped */
+    int recover = opts.maxerrors >= 0 || opts.quarantine;
+    if (recover && !startquarantine(opts.quarantine, opts.maxerrors)) {
+        delSchema(schema);
+        free(opts.outdir);
+        return 1;
+    }
+    
+    if (opts.pipeline) {
+        Checkpoint cp;
+        if (opts.resume) {
+            if (!loadcheckpoint(schema, opts.outdir, &cp) || !skipinput(input, cp.offset)) {
+                delSchema(schema);
+                free(opts.outdir);
+                return 1;
+            }
+            setnid(cp.nextid);
+            set_first_record(cp.records);
+        }
+        yyin = quarantineinput(input, opts.resume ? cp.offset : 0);
+        startwriter(opts.asyncio, opts.iodepth);
+        if (!startpipeline(schema, opts.outdir, opts.checkpoint, opts.resume ? &cp : NULL)) {
+            fprintf(stderr, "Error: Could not start the pipeline threads\n");
+            stopwriter();
+            stopquarantine();
+            closeinput();
+            delSchema(schema);
+            free(opts.outdir);
+            return 1;
+        }
+    }
     
-    /* Read from stdin by default */
-    yyin = stdin;
+    if (!opts.pipeline) yyin = quarantineinput(input, 0);
     
     /* Parse the input JSON */
+    statsbegin(PHASE_PARSE);
     int parse_result = yyparse();
+    int streamed = stoppipeline(parse_result == 0);
+    statsend(PHASE_PARSE);
+    stopquarantine();
+    closeinput();
     if (parse_result != 0) {
+        report_parse_error();
         fprintf(stderr, "Error: JSON parsing failed\n");
-        free(output_dir);
+        stopwriter();
+        reportstats(&opts, NULL);
+        free(opts.outdir);
         return 1;
     }
     
     /* Get the AST root */
     ASTNode* ast = get_ast_root();
+    if (!ast && filtering()) {
+        /* The root record was rejected by --where: nothing to write */
+        stopwriter();
+        reportstats(&opts, NULL);
+        freewhere();
+        freeselect();
+        free(opts.outdir);
+        return 0;
+    }
     if (!ast) {
         fprintf(stderr, "Error: Failed to build AST\n");
-        free(output_dir);
+        stopwriter();
+        free(opts.outdir);
         return 1;
     }
     
     /* Print AST if requested */
-    if (should_printast) {
+    if (opts.printast) {
         printf("\n%s===== Standard AST =====%s\n", "\033[1;37m", "\033[0m");
         printast(ast, 0);
     }
     
-    /* Generate schema from AST */
-    Schema* schema = makeSchema();
-    genSchema(schema, ast);
+    /* Generate schema from AST, or let makecsv discover it in a single pass */
+    if (!schema) {
+        schema = makeSchema();
+        schema->dedup = opts.dedup;
+        if (opts.singlepass) {
+            schema->discover = 1;
+        } else {
+            statsbegin(PHASE_SCHEMA);
+            genSchema(schema, ast);
+            statsend(PHASE_SCHEMA);
+        }
+    }
     
     /* Generate CSV files */
-    makecsv(schema, ast, output_dir);
+    statsbegin(PHASE_CSV);
+    startwriter(opts.asyncio, opts.iodepth);
+    if (streamed) {
+        /* The rows were written while parsing */
+        sinkend(schema);
+    } else {
+        makecsv(schema, ast);
+    }
+    /* A failed write keeps the checkpoint, and the next --append scans the files instead */
+    int written = stopwriter();
+    statsend(PHASE_CSV);
+    if (opts.pipeline && written) clearcheckpoint(opts.outdir);
+    if (opts.schemaout) writemanifest(schema, opts.schemaout);
+    if (opts.profile) writeprofile(schema, opts.profile);
+    if (opts.append && written) {
+        saveappend(schema, opts.outdir, peeknid());
+    } else {
+        /* The files were rewritten: a saved append state no longer describes them */
+        clearappend(opts.outdir);
+    }
+    
+    reportstats(&opts, schema);
     
     /* Clean up */
     delSchema(schema);
     deleteast(ast);
-    free(output_dir);
+    freeselect();
+    freewhere();
+    freenaming();
+    freenaturalkeys();
+    stopprofile();
+    freeshards();
+    free(opts.outdir);
     
-    return 0;
+    return written ? 0 : 1;
 }
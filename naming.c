@@ -0,0 +1,456 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "naming.h"
+
+/* The rules matching today's feeds */
+static const char* defaultrules =
+    "root postId -> posts\n"
+    "root orderId|order_id -> orders\n"
+    "root items total|customer -> orders\n"
+    "root -> root\n"
+    "key=items sku qty|quantity|price -> order_items\n"
+    "key=author uid:s -> users\n"
+    "key=comments uid:s -> users\n"
+    "key=* postId -> posts\n"
+    "key=* type:s -> $plural(type)\n"
+    "key=* kind:s -> $plural(kind)\n"
+    "key=* name:s -> $plural(name)\n"
+    "key=* category:s -> $plural(category)\n"
+    "key=* class:s -> $plural(class)\n"
+    "key=author -> users\n"
+    "key=* -> $key\n"
+    "element -> $parent\n";
+
+typedef enum {
+    RESULT_LITERAL,
+    RESULT_PLURAL,
+    RESULT_KEY,
+    RESULT_PARENT
+} ResultKind;
+
+/* One alternative of a condition */
+typedef struct {
+    char** path;        /* Keys from the object down, split on dots */
+    int depth;
+    char type;          /* Signature letter the value must have, 0 for any */
+} NameAlt;
+
+typedef struct {
+    NameAlt* alts;
+    int count;
+} NameCond;
+
+typedef struct NameRule {
+    int seq;                /* Position in the rule list */
+    NameContext context;
+    char* parent_key;       /* NAME_KEY: key to match, NULL for any */
+    NameCond* conds;
+    int condcount;
+    int deep;               /* A condition looks below the object's own keys */
+    ResultKind result;
+    char* arg;              /* Literal name or $plural field */
+    struct NameRule* next;  /* Next rule in the same dispatch list */
+} NameRule;
+
+#define NAME_BUCKETS 64
+#define MEMO_BUCKETS 256
+
+/* A memoized (context, parent key, shape) lookup */
+typedef struct MemoEntry {
+    char* key;
+    NameRule* rule;
+    struct MemoEntry* next;
+} MemoEntry;
+
+static NameRule* rootrules = NULL;
+static NameRule* elemrules = NULL;
+static NameRule* anykeyrules = NULL;
+static NameRule* keyrules[NAME_BUCKETS];    /* Rules for a named parent key */
+static MemoEntry* memo[MEMO_BUCKETS];
+static int rulecount = 0;
+static int defaultsloaded = 0;
+
+static unsigned long hashstr(const char* s) {
+    unsigned long h = 1469598103934665603UL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+char* tolowercase(const char* str) {
+    size_t len = strlen(str);
+    char* lower = malloc(len + 1);
+    if (!lower) return NULL;
+
+    for (size_t i = 0; i < len; i++) {
+        lower[i] = tolower(str[i]);
+    }
+    lower[len] = '\0';
+    return lower;
+}
+
+int endswiths(const char* str) {
+    size_t len = strlen(str);
+    return len > 0 && str[len - 1] == 's';
+}
+
+/* Append a rule to the end of a dispatch list, keeping file order */
+static void appendrule(NameRule** list, NameRule* rule) {
+    while (*list) list = &(*list)->next;
+    *list = rule;
+}
+
+static void freealt(NameAlt* alt) {
+    for (int i = 0; i < alt->depth; i++) free(alt->path[i]);
+    free(alt->path);
+}
+
+static void freerule(NameRule* rule) {
+    for (int i = 0; i < rule->condcount; i++) {
+        for (int j = 0; j < rule->conds[i].count; j++) freealt(&rule->conds[i].alts[j]);
+        free(rule->conds[i].alts);
+    }
+    free(rule->conds);
+    free(rule->parent_key);
+    free(rule->arg);
+    free(rule);
+}
+
+/* Split a condition key into its path, as --where does with field paths */
+static int parsepath(NameAlt* a, const char* key) {
+    a->path = NULL;
+    a->depth = 0;
+    const char* p = key;
+    for (;;) {
+        const char* dot = strchr(p, '.');
+        size_t seglen = dot ? (size_t)(dot - p) : strlen(p);
+        if (seglen == 0) return 0;
+        char** path = realloc(a->path, (a->depth + 1) * sizeof(char*));
+        if (!path) return 0;
+        a->path = path;
+        a->path[a->depth++] = strndup(p, seglen);
+        if (!dot) return 1;
+        p = dot + 1;
+    }
+}
+
+static int parsecond(NameCond* cond, char* token) {
+    cond->alts = NULL;
+    cond->count = 0;
+    char* save;
+    for (char* alt = strtok_r(token, "|", &save); alt; alt = strtok_r(NULL, "|", &save)) {
+        NameAlt* alts = realloc(cond->alts, (cond->count + 1) * sizeof(NameAlt));
+        if (!alts) return 0;
+        cond->alts = alts;
+        NameAlt* a = &cond->alts[cond->count++];
+        a->type = 0;
+        char* colon = strrchr(alt, ':');
+        if (colon && strlen(colon + 1) == 1 && strchr("sinb0oa", colon[1])) {
+            a->type = colon[1];
+            *colon = '\0';
+        }
+        if (!parsepath(a, alt)) return 0;
+    }
+    return cond->count > 0;
+}
+
+/* Compile one rule line; returns 0 on a syntax error */
+static int parserule(char* line) {
+    char* arrow = strstr(line, "->");
+    if (!arrow) return 0;
+    *arrow = '\0';
+    char* target = strtok(arrow + 2, " \t\r\n");
+    if (!target) return 0;
+
+    NameRule* rule = calloc(1, sizeof(NameRule));
+    if (!rule) return 0;
+    rule->seq = rulecount;
+    if (strcmp(target, "$key") == 0) {
+        rule->result = RESULT_KEY;
+    } else if (strcmp(target, "$parent") == 0) {
+        rule->result = RESULT_PARENT;
+    } else if (strncmp(target, "$plural(", 8) == 0 && target[strlen(target) - 1] == ')') {
+        rule->result = RESULT_PLURAL;
+        rule->arg = strndup(target + 8, strlen(target) - 9);
+    } else {
+        rule->result = RESULT_LITERAL;
+        rule->arg = strdup(target);
+    }
+
+    char* context = strtok(line, " \t");
+    if (!context) {
+        freerule(rule);
+        return 0;
+    }
+    if (strcmp(context, "root") == 0) {
+        rule->context = NAME_ROOT;
+    } else if (strcmp(context, "element") == 0) {
+        rule->context = NAME_ELEM;
+    } else if (strncmp(context, "key=", 4) == 0 && context[4]) {
+        rule->context = NAME_KEY;
+        rule->parent_key = strcmp(context + 4, "*") == 0 ? NULL : strdup(context + 4);
+    } else {
+        freerule(rule);
+        return 0;
+    }
+    for (char* token = strtok(NULL, " \t"); token; token = strtok(NULL, " \t")) {
+        NameCond* conds = realloc(rule->conds, (rule->condcount + 1) * sizeof(NameCond));
+        if (!conds) {
+            freerule(rule);
+            return 0;
+        }
+        rule->conds = conds;
+        NameCond* cond = &rule->conds[rule->condcount++];
+        if (!parsecond(cond, token)) {
+            freerule(rule);
+            return 0;
+        }
+        for (int i = 0; i < cond->count; i++) {
+            if (cond->alts[i].depth > 1) rule->deep = 1;
+        }
+    }
+    if (rule->result == RESULT_KEY && rule->context != NAME_KEY) {
+        freerule(rule);
+        return 0;
+    }
+
+    switch (rule->context) {
+        case NAME_ROOT:
+            appendrule(&rootrules, rule);
+            break;
+        case NAME_ELEM:
+            appendrule(&elemrules, rule);
+            break;
+        case NAME_KEY:
+            if (rule->parent_key) {
+                appendrule(&keyrules[hashstr(rule->parent_key) % NAME_BUCKETS], rule);
+            } else {
+                appendrule(&anykeyrules, rule);
+            }
+            break;
+    }
+    rulecount++;
+    return 1;
+}
+
+/* Compile every line of text; blank lines and # comments are ignored */
+static int compilerules(const char* text, const char* origin) {
+    char* copy = strdup(text);
+    if (!copy) return 0;
+    int ok = 1;
+    int lineno = 0;
+    char* save;
+    for (char* line = strtok_r(copy, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        lineno++;
+        char* p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0' || *p == '#') continue;
+        if (!parserule(p)) {
+            fprintf(stderr, "Error: Invalid naming rule at %s:%d\n", origin, lineno);
+            ok = 0;
+        }
+    }
+    free(copy);
+    return ok;
+}
+
+/* Add the built-in rules after those of --naming-rules; returns 0 when one is malformed */
+int loadnamingdefaults() {
+    if (defaultsloaded) return 1;
+    defaultsloaded = 1;
+    return compilerules(defaultrules, "built-in rules");
+}
+
+/* Load rules from a file; they take precedence over the built-in rules */
+int loadnamingrules(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error: Could not open naming rules %s\n", path);
+        return 0;
+    }
+    size_t cap = 4096;
+    size_t len = 0;
+    char* text = malloc(cap);
+    size_t n;
+    while (text && (n = fread(text + len, 1, cap - len - 1, fp)) > 0) {
+        len += n;
+        if (len + 1 == cap) {
+            cap *= 2;
+            char* grown = realloc(text, cap);
+            if (!grown) {
+                free(text);
+                text = NULL;
+            }
+            text = grown;
+        }
+    }
+    fclose(fp);
+    if (!text) return 0;
+    text[len] = '\0';
+    int ok = compilerules(text, path);
+    free(text);
+    return ok;
+}
+
+static char sigletter(ASTNode* node) {
+    switch (nodetype(node)) {
+        case nodestr: return 's';
+        case nodeint: return 'i';
+        case nodenum: return 'n';
+        case nodebool: return 'b';
+        case nodenull: return '0';
+        case nodeobj: return 'o';
+        case nodearr: return 'a';
+        default: return 0;
+    }
+}
+
+/* Value at the end of a condition's path below obj, NULL when a key on the way is missing */
+static ASTNode* altvalue(ASTNode* obj, NameAlt* alt) {
+    ASTNode* node = obj;
+    for (int i = 0; i < alt->depth && node; i++) node = getbyname(node, alt->path[i]);
+    return node;
+}
+
+static int rulematches(NameRule* rule, ASTNode* obj) {
+    for (int i = 0; i < rule->condcount; i++) {
+        NameCond* cond = &rule->conds[i];
+        int found = 0;
+        for (int j = 0; j < cond->count && !found; j++) {
+            ASTNode* value = altvalue(obj, &cond->alts[j]);
+            found = value && (!cond->alts[j].type || sigletter(value) == cond->alts[j].type);
+        }
+        if (!found) return 0;
+    }
+    return 1;
+}
+
+/*
+ * First matching rule, walking the key's own rules and the key=* rules in
+ * file order; deep is set when a rule tried looked below the object's keys
+ */
+static NameRule* findrule(ASTNode* obj, NameContext context, const char* parent_key, int* deep) {
+    NameRule* specific = NULL;
+    NameRule* general;
+    switch (context) {
+        case NAME_ROOT:
+            general = rootrules;
+            break;
+        case NAME_ELEM:
+            general = elemrules;
+            break;
+        default:
+            general = anykeyrules;
+            specific = keyrules[hashstr(parent_key) % NAME_BUCKETS];
+            break;
+    }
+    while (specific && strcmp(specific->parent_key, parent_key) != 0) specific = specific->next;
+    while (specific || general) {
+        NameRule* rule;
+        if (specific && (!general || specific->seq < general->seq)) {
+            rule = specific;
+            specific = specific->next;
+            while (specific && strcmp(specific->parent_key, parent_key) != 0) specific = specific->next;
+        } else {
+            rule = general;
+            general = general->next;
+        }
+        if (rule->deep) *deep = 1;
+        if (rulematches(rule, obj)) return rule;
+    }
+    return NULL;
+}
+
+/*
+ * Rule choice depends only on the shape, so it is cached by (context, parent
+ * key, signature), unless a rule tried tests a nested key the signature
+ * does not describe
+ */
+static NameRule* memorule(ASTNode* obj, NameContext context, const char* parent_key, const char* signature) {
+    int deep = 0;
+    if (!signature) return findrule(obj, context, parent_key, &deep);
+    size_t len = strlen(signature) + (parent_key ? strlen(parent_key) : 0) + 4;
+    char* key = malloc(len);
+    if (!key) return findrule(obj, context, parent_key, &deep);
+    snprintf(key, len, "%d\x1f%s\x1f%s", context, parent_key ? parent_key : "", signature);
+    unsigned long bucket = hashstr(key) % MEMO_BUCKETS;
+    for (MemoEntry* e = memo[bucket]; e; e = e->next) {
+        if (strcmp(e->key, key) == 0) {
+            free(key);
+            return e->rule;
+        }
+    }
+    NameRule* rule = findrule(obj, context, parent_key, &deep);
+    MemoEntry* entry = deep ? NULL : malloc(sizeof(MemoEntry));
+    if (!entry) {
+        free(key);
+        return rule;
+    }
+    entry->key = key;
+    entry->rule = rule;
+    entry->next = memo[bucket];
+    memo[bucket] = entry;
+    return rule;
+}
+
+/* Name the table of an object; signature may be NULL to skip the memo */
+char* nametable(ASTNode* obj, NameContext context, const char* parent_key,
+                const char* parent_table, const char* signature) {
+    if (context == NAME_KEY && !parent_key) context = NAME_ELEM;
+    NameRule* rule = memorule(obj, context, parent_key, signature);
+    if (!rule) return strdup(parent_table ? parent_table : "root");
+    switch (rule->result) {
+        case RESULT_KEY:
+            return tolowercase(parent_key);
+        case RESULT_PARENT:
+            return strdup(parent_table ? parent_table : "root");
+        case RESULT_PLURAL: {
+            ASTNode* field = getbyname(obj, rule->arg);
+            if (!field || nodetype(field) != nodestr) {
+                return strdup(parent_table ? parent_table : "root");
+            }
+            char* name = tolowercase(getstr(field));
+            if (name[0] && !endswiths(name)) {
+                char* plural = malloc(strlen(name) + 2);
+                sprintf(plural, "%ss", name);
+                free(name);
+                return plural;
+            }
+            return name;
+        }
+        default:
+            return strdup(rule->arg);
+    }
+}
+
+void freenaming() {
+    NameRule** lists[] = { &rootrules, &elemrules, &anykeyrules };
+    for (int i = 0; i < 3; i++) {
+        while (*lists[i]) {
+            NameRule* next = (*lists[i])->next;
+            freerule(*lists[i]);
+            *lists[i] = next;
+        }
+    }
+    for (int i = 0; i < NAME_BUCKETS; i++) {
+        while (keyrules[i]) {
+            NameRule* next = keyrules[i]->next;
+            freerule(keyrules[i]);
+            keyrules[i] = next;
+        }
+    }
+    for (int i = 0; i < MEMO_BUCKETS; i++) {
+        while (memo[i]) {
+            MemoEntry* next = memo[i]->next;
+            free(memo[i]->key);
+            free(memo[i]);
+            memo[i] = next;
+        }
+    }
+    rulecount = 0;
+    defaultsloaded = 0;
+}
@@ -0,0 +1,40 @@
+#ifndef NAMING_H
+#define NAMING_H
+
+#include "ast.h"
+
+/*
+ * Table naming rules. Each rule is one line of a rules file:
+ *
+ *   <context> [<condition> ...] -> <name>
+ *
+ * context:   root | element | key=<key> | key=*
+ *            (the root object, an array element, an object under a key)
+ * condition: key[:type][|key[:type]...], at least one alternative present;
+ *            key may be a dotted path into nested objects (author.uid);
+ *            type is one of s i n b 0 o a (string, integer, number, boolean,
+ *            null, object, array)
+ * name:      a literal, $key (the parent key lowercased), $parent (the parent
+ *            table) or $plural(field) (a string field lowercased, with an 's'
+ *            appended when missing)
+ *
+ * Rules are tried in order and the first match wins. Rules loaded with
+ * --naming-rules come before the built-in ones, which are loaded once the
+ * options are parsed. Rules are dispatched by context and parent key
+ * through a hash table, and the winning rule is memoized per (context,
+ * parent key, shape) unless a dotted condition had to be tested.
+ */
+
+typedef enum {
+    NAME_ROOT,
+    NAME_KEY,
+    NAME_ELEM
+} NameContext;
+
+int loadnamingrules(const char* path);
+int loadnamingdefaults();
+char* nametable(ASTNode* obj, NameContext context, const char* parent_key,
+                const char* parent_table, const char* signature);
+void freenaming();
+
+#endif
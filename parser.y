@@ -3,21 +3,159 @@
 #include <stdlib.h>
 #include <string.h>
 #include "ast.h"
+#include "select.h"
+#include "where.h"
+#include "quarantine.h"
 
 extern int yylex(void);
+extern void skip_next_value(void);
+extern int piping(void);
+extern int piperecord(ASTNode* record, int index);
 extern FILE* yyin;
 extern int yycolumn, yyline;
 
 void yyerror(const char* s);
 
+/*
+ * The parser works on its own copy of each token's value and location, so
+ * that with --pipeline the scanner can fill yylval and yylloc on another
+ * thread. nexttoken() hands the tokens over.
+ */
+#define yylval parser_lval
+#define yylloc parser_lloc
+#define yylex nexttoken
+static int nexttoken(void);
+
 /* Root node of our AST */
 ASTNode* ast_root = NULL;
+
+/* Deepest object/array nesting accepted, and the current nesting */
+int max_parse_depth = 10000;
+static int parse_depth = 0;
+
+/* Build the flat tape AST instead of the node tree (--tape) */
+static int use_tape = 0;
+static int dedup = 0;
+
+/* Set when the value of the pair being reduced was skipped by --select */
+static int skipped = 0;
+
+/* Where the current element of a root array began, to discard it on --where */
+static ASTMark recordmark;
+
+/* Position of the next element kept in the root array */
+static int recordindex = 0;
+static int firstrecord = 0;     /* Elements already written by an interrupted run */
+
+/* Diagnostic of the last syntax error, for the quarantine; pending until a bad record takes it */
+static char lasterror[256];
+static int errorpending = 0;
+
+/* Decide whether the element just completed stays in its array */
+static int keepelem(ASTNode* elem) {
+    int keep = 1;
+    if (seldropelem()) {
+        dropnode(elem);
+        keep = 0;
+    } else if (parse_depth == 1 && !wherematch(use_tape ? tapelast() : elem)) {
+        rewindast(&recordmark, elem);
+        keep = 0;
+    }
+    if (parse_depth == 1) {
+        markast(&recordmark);
+        /* A record the pipeline took is freed once written, not kept in the array */
+        if (keep && piping() && piperecord(elem, recordindex++)) keep = 0;
+    }
+    return keep;
+}
+
+/* Add a completed element to the list of its array, which starts out NULL; returns 0 when out of memory */
+static int addelem(ASTNode*** values, ASTNode* elem) {
+    if (!keepelem(elem)) {
+        if (!use_tape && !*values) *values = calloc(1, sizeof(ASTNode*));
+        return use_tape || *values != NULL;
+    }
+    if (use_tape) {
+        tapeslot(NULL);
+        return 1;
+    }
+    int count = 0;
+    while (*values && (*values)[count] != NULL) count++;
+    ASTNode** grown = realloc(*values, (count + 2) * sizeof(ASTNode*));
+    if (!grown) return 0;
+    grown[count] = elem;
+    grown[count + 1] = NULL;
+    *values = grown;
+    return 1;
+}
+
+static ASTNode* closearray(ASTNode** values) {
+    parse_depth--;
+    selclose();
+    if (use_tape) {
+        tapeclose(nodearr);
+        return NULL;
+    }
+    int count = 0;
+    while (values && values[count] != NULL) count++;
+    return arrnode(values, count);
+}
+
+/* Free what error recovery pops off the stack */
+static void droppair(KeyValuePair* pair) {
+    if (!pair) return;
+    free(pair->key);
+    deleteast(pair->value);
+    free(pair);
+}
+
+static void droppairs(KeyValuePair** pairs) {
+    for (int i = 0; pairs && pairs[i]; i++) droppair(pairs[i]);
+    free(pairs);
+}
+
+static void dropelems(ASTNode** elems) {
+    for (int i = 0; elems && elems[i]; i++) deleteast(elems[i]);
+    free(elems);
+}
+
+#define YYLLOC_DEFAULT(Cur, Rhs, N) do { \
+    if (N) { \
+        (Cur).first_line = YYRHSLOC(Rhs, 1).first_line; \
+        (Cur).first_column = YYRHSLOC(Rhs, 1).first_column; \
+        (Cur).first_byte = YYRHSLOC(Rhs, 1).first_byte; \
+        (Cur).last_line = YYRHSLOC(Rhs, N).last_line; \
+        (Cur).last_column = YYRHSLOC(Rhs, N).last_column; \
+        (Cur).last_byte = YYRHSLOC(Rhs, N).last_byte; \
+    } else { \
+        (Cur).first_line = (Cur).last_line = YYRHSLOC(Rhs, 0).last_line; \
+        (Cur).first_column = (Cur).last_column = YYRHSLOC(Rhs, 0).last_column; \
+        (Cur).first_byte = (Cur).last_byte = YYRHSLOC(Rhs, 0).last_byte; \
+    } \
+} while (0)
+
+/* Let the parser stack grow with the nesting limit instead of Bison's default */
+#define YYMAXDEPTH (8L * max_parse_depth + 200)
 %}
 
 /* Bison declarations */
 %define parse.error verbose
 %locations
 
+%code requires {
+/* Token locations also carry input byte offsets, for --quarantine */
+typedef struct YYLTYPE {
+    int first_line;
+    int first_column;
+    int last_line;
+    int last_column;
+    long first_byte;
+    long last_byte;
+} YYLTYPE;
+#define YYLTYPE_IS_DECLARED 1
+#define YYLTYPE_IS_TRIVIAL 1
+}
+
 %union {
     long ival;
     double dval;
@@ -35,113 +173,287 @@ ASTNode* ast_root = NULL;
 %token <sval> STRING
 %token <bval> BOOLEAN
 %token NULLVAL
+%token SKIPPED
+%token <sval> BADTOKEN      /* Input the scanner could not read; the value is the diagnostic */
 
 /* Define tokens for punctuation to avoid character value conflicts */
 %token LBRACE RBRACE LBRACKET RBRACKET COLON COMMA
 
 /* Non-terminal types */
-%type <node> value object array
+%type <node> value object array scalar document root_array
 %type <kvpair> pair
 %type <kvpairs> pairs
-%type <nodes> values
+%type <nodes> values records
+
+/* Elements already kept in records may be written by the pipeline, so records has no destructor */
+%destructor { free($$); } <sval>
+%destructor { deleteast($$); } value object array scalar
+%destructor { droppair($$); } pair
+%destructor { droppairs($$); } pairs
+%destructor { dropelems($$); } values
 
 /* Precedence (not really needed for JSON but good practice) */
 %left LBRACE RBRACE
 %left LBRACKET RBRACKET
 
+%code {
+/*
+ * Skip the rest of a bad element of the root array, starting at byte start:
+ * the tokens up to the ',' or ']' that follows it, counting the containers
+ * it left open. The element goes to the quarantine. Returns 0 when the run
+ * has to stop: recovery is off, the input ended or --max-errors was reached.
+ */
+static int recover(int* lookahead, long start) {
+    if (!recovering()) return 0;
+    errorpending = 0;
+    int depth = parse_depth - 1;
+    int token = *lookahead;
+    long end = start;
+    while (token > 0 && (depth > 0 || (token != ',' && token != ']'))) {
+        if (token == '{' || token == '[') {
+            depth++;
+        } else if (token == '}' || token == ']') {
+            if (depth > 0) depth--;
+        } else if (token == STRING || token == BADTOKEN) {
+            free(yylval.sval);
+        }
+        end = yylloc.last_byte;
+        token = nexttoken();
+    }
+    *lookahead = token;
+    while (parse_depth > 1) {
+        selclose();
+        parse_depth--;
+    }
+    skipped = 0;
+    /* The nodes of the bad element were freed by the parser's destructors */
+    rewindids(&recordmark);
+    return quarantine(start, end, lasterror) && token > 0;
+}
+}
+
 %%
 
 /* Grammar rules */
 json:
-    value           { ast_root = $1; }
+    document        { 
+        ast_root = use_tape ? tapelast() : $1;
+        /* A root object is a record of its own */
+        if (isobj(ast_root) && !wherematch(ast_root)) {
+            deleteast(ast_root);
+            ast_root = NULL;
+        }
+    }
+    ;
+
+/* A root array is a sequence of records; with --max-errors a bad record is skipped */
+document:
+    object          { $$ = $1; }
+    | scalar        { $$ = $1; }
+    | root_array    { $$ = $1; }
+    ;
+
+root_array:
+    open_bracket ']'            { $$ = closearray(NULL); }
+    | open_bracket records ']'  { $$ = closearray($2); }
+    ;
+
+records:
+    value           { 
+        $$ = NULL;
+        if (!addelem(&$$, $1)) {
+            yyerror("Memory allocation failed");
+            YYABORT;
+        }
+        quarantinekeep(@1.last_byte);
+    }
+    | records ',' value { 
+        $$ = $1;
+        if (!addelem(&$$, $3)) {
+            yyerror("Memory allocation failed");
+            YYABORT;
+        }
+        quarantinekeep(@3.last_byte);
+    }
+    | error         { 
+        if (!recover(&yychar, @1.first_byte)) YYABORT;
+        yyerrok;
+        $$ = use_tape ? NULL : calloc(1, sizeof(ASTNode*));
+    }
+    | records ',' error { 
+        if (!recover(&yychar, @3.first_byte)) YYABORT;
+        yyerrok;
+        $$ = $1;
+    }
+    | records error { 
+        /* A missing ',': keep the records before it and skip up to the next one */
+        if (!recover(&yychar, @2.first_byte)) YYABORT;
+        yyerrok;
+        $$ = $1;
+    }
     ;
 
 object:
-    '{' '}'         { $$ = objnode(NULL, 0); }
-    | '{' pairs '}' { 
-        int count = 0;
-        while ($2[count] != NULL) count++;
-        $$ = objnode($2, count);
+    open_brace '}'         { 
+        parse_depth--;
+        selclose();
+        if (use_tape) {
+            tapeclose(nodeobj);
+            $$ = NULL;
+        } else {
+            $$ = objnode(NULL, 0);
+        }
+    }
+    | open_brace pairs '}' { 
+        parse_depth--;
+        selclose();
+        if (use_tape) {
+            tapeclose(nodeobj);
+            $$ = NULL;
+        } else {
+            int count = 0;
+            while ($2[count] != NULL) count++;
+            $$ = objnode($2, count);
+        }
     }
     ;
 
 pairs:
     pair            { 
-        $$ = calloc(2, sizeof(KeyValuePair*));
-        if (!$$) {
-            yyerror("Memory allocation failed");
-            YYABORT;
+        if (use_tape) {
+            $$ = NULL;
+        } else {
+            $$ = calloc(2, sizeof(KeyValuePair*));
+            if (!$$) {
+                yyerror("Memory allocation failed");
+                YYABORT;
+            }
+            $$[0] = $1;
+            $$[1] = NULL;
         }
-        $$[0] = $1;
-        $$[1] = NULL;
     }
     | pairs ',' pair { 
-        int count = 0;
-        while ($1[count] != NULL) count++;
-        $$ = realloc($1, (count + 2) * sizeof(KeyValuePair*));
-        if (!$$) {
-            yyerror("Memory allocation failed");
-            YYABORT;
+        if (use_tape) {
+            $$ = NULL;
+        } else {
+            int count = 0;
+            while ($1[count] != NULL) count++;
+            $$ = realloc($1, (count + 2) * sizeof(KeyValuePair*));
+            if (!$$) {
+                yyerror("Memory allocation failed");
+                YYABORT;
+            }
+            $$[count] = $3;
+            $$[count + 1] = NULL;
         }
-        $$[count] = $3;
-        $$[count + 1] = NULL;
     }
     ;
 
 pair:
-    STRING ':' value { 
-        $$ = createKVpair($1, $3);
-        free($1); /* Free the string as it's copied in createKVpair */
+    STRING ':' { if (!selkey($1)) skip_next_value(); } value { 
+        if (skipped) {
+            skipped = 0;
+            free($1);
+            $$ = NULL;
+        } else if (use_tape) {
+            tapeslot($1);
+            free($1);
+            $$ = NULL;
+        } else {
+            /* The scanned key becomes the pair's own */
+            $$ = moveKVpair($1, $4);
+        }
+    }
+    ;
+
+open_brace:
+    '{'             { 
+        if (++parse_depth > max_parse_depth) { yyerror("maximum nesting depth exceeded"); YYABORT; }
+        selopen(0);
+        if (use_tape) tapeopen();
     }
     ;
 
 array:
-    '[' ']'         { $$ = arrnode(NULL, 0); }
-    | '[' values ']' { 
-        int count = 0;
-        while ($2[count] != NULL) count++;
-        $$ = arrnode($2, count);
+    open_bracket ']'         { $$ = closearray(NULL); }
+    | open_bracket values ']' { $$ = closearray($2); }
+    ;
+
+open_bracket:
+    '['             { 
+        if (++parse_depth > max_parse_depth) { yyerror("maximum nesting depth exceeded"); YYABORT; }
+        selopen(1);
+        if (use_tape) tapeopen();
+        if (parse_depth == 1) {
+            markast(&recordmark);
+            recordindex = firstrecord;
+        }
     }
     ;
 
 values:
     value           { 
-        $$ = calloc(2, sizeof(ASTNode*));
-        if (!$$) {
+        $$ = NULL;
+        if (!addelem(&$$, $1)) {
             yyerror("Memory allocation failed");
             YYABORT;
         }
-        $$[0] = $1;
-        $$[1] = NULL;
     }
     | values ',' value { 
-        int count = 0;
-        while ($1[count] != NULL) count++;
-        $$ = realloc($1, (count + 2) * sizeof(ASTNode*));
-        if (!$$) {
+        $$ = $1;
+        if (!addelem(&$$, $3)) {
             yyerror("Memory allocation failed");
             YYABORT;
         }
-        $$[count] = $3;
-        $$[count + 1] = NULL;
     }
     ;
 
 value:
-    object          { $$ = $1; }
-    | array         { $$ = $1; }
-    | STRING        { $$ = strnode($1); free($1); }
-    | INTEGER       { $$ = intnode($1); }
-    | NUMBER        { $$ = numnode($1); }
-    | BOOLEAN       { $$ = boolnode($1); }
-    | NULLVAL       { $$ = nullnode(); }
+    object          { $$ = $1; if (dedup) merkle($$); }
+    | array         { $$ = $1; if (dedup) merkle($$); }
+    | scalar        { $$ = $1; if (dedup) merkle($$); }
+    ;
+
+scalar:
+    STRING        { if (use_tape) { tapestr($1); free($1); $$ = NULL; } else $$ = movestrnode($1); }
+    | INTEGER       { if (use_tape) { tapeint($1); $$ = NULL; } else $$ = intnode($1); }
+    | NUMBER        { if (use_tape) { tapenum($1); $$ = NULL; } else $$ = numnode($1); }
+    | BOOLEAN       { if (use_tape) { tapebool($1); $$ = NULL; } else $$ = boolnode($1); }
+    | NULLVAL       { if (use_tape) { tapenull(); $$ = NULL; } else $$ = nullnode(); }
+    | SKIPPED       { skipped = 1; $$ = NULL; }
     ;
 
 %%
 
+#undef yylex
+#undef yylval
+#undef yylloc
+
+/* Value and location of the token the scanner matched last */
+YYSTYPE yylval;
+YYLTYPE yylloc = { 1, 1, 1, 1, 0, 0 };
+
+extern int pipetoken(YYSTYPE* value, YYLTYPE* loc);
+
+static int nexttoken(void) {
+    if (piping()) return pipetoken(&parser_lval, &parser_lloc);
+    int token = yylex();
+    parser_lval = yylval;
+    parser_lloc = yylloc;
+    return token;
+}
+
 void yyerror(const char* s) {
+    /* The scanner describes the input it could not read */
+    if (yychar == BADTOKEN) s = parser_lval.sval;
+    if (recovering()) {
+        snprintf(lasterror, sizeof(lasterror), "%s at line %d, column %d",
+                 s, parser_lloc.first_line, parser_lloc.first_column);
+        errorpending = 1;
+        return;
+    }
     fprintf(stderr, "Error: %s at line %d, column %d\n", 
-            s, yylloc.first_line, yylloc.first_column);
+            s, parser_lloc.first_line, parser_lloc.first_column);
     fprintf(stderr, "DEBUG: Last token type: %d\n", yychar);
     
     /* Print token definitions for debugging */
@@ -159,4 +471,33 @@ ASTNode* get_ast_root() {
 /* Reset parser for multiple runs */
 void reset_parser() {
     ast_root = NULL;
+    parse_depth = 0;
+    errorpending = 0;
+}
+
+/* Print the diagnostic held back for recovery when no bad record took it */
+void report_parse_error() {
+    if (!errorpending) return;
+    errorpending = 0;
+    fprintf(stderr, "Error: %s\n", lasterror);
+}
+
+/* Limit how deeply objects and arrays may nest */
+void set_max_depth(int depth) {
+    max_parse_depth = depth;
+}
+
+/* Number the root array elements from first, for --resume */
+void set_first_record(int first) {
+    firstrecord = first;
+}
+
+/* Build the flat tape AST instead of the node tree */
+void set_tape_mode(int enabled) {
+    use_tape = enabled;
+}
+
+/* Hash every value as it is reduced, for --dedup-subtrees */
+void set_dedup_mode(int enabled) {
+    dedup = enabled;
 }
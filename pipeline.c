@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "ast.h"
+#include "parser.tab.h"
+#include "csv.h"
+#include "stats.h"
+#include "writer.h"
+#include "checkpoint.h"
+#include "pipeline.h"
+#include "trace.h"
+
+#define TOKEN_RING 65536
+#define TOKEN_BATCH 256
+#define RECORD_RING 1024
+#define RECORD_BATCH 16
+#define SPIN_LIMIT 64       /* Yields before a waiting side blocks on the ring's condition */
+
+extern int yylex(void);
+
+typedef struct {
+    int type;
+    YYSTYPE value;
+    YYLTYPE loc;        /* With byte offsets from the start of the input */
+} Token;
+
+typedef struct {
+    ASTNode* record;    /* NULL after the last record */
+    int index;
+    long offset;        /* Input offset just past the record */
+    long nextid;        /* Node id following the record */
+} Record;
+
+/*
+ * Single-producer single-consumer ring. Each side works on private
+ * positions and publishes them every batch elements, or before it waits.
+ * A side that finds the ring full or empty yields SPIN_LIMIT times, then
+ * sleeps on the ring's condition until the other side publishes.
+ */
+typedef struct {
+    char* slots;
+    size_t elemsize;
+    unsigned long mask;
+    unsigned long batch;
+    unsigned long tail;         /* Producer: next slot to fill */
+    unsigned long headcache;    /* Producer: last head seen */
+    unsigned long head;         /* Consumer: next slot to read */
+    unsigned long tailcache;    /* Consumer: last tail seen */
+    _Alignas(64) unsigned long pubtail;
+    _Alignas(64) unsigned long pubhead;
+    _Alignas(64) int sleeping;  /* Sides waiting on changed */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} SpscRing;
+
+static SpscRing tokens;
+static SpscRing records;
+static pthread_t tokenizer;
+static pthread_t emitter;
+static int active = 0;
+static int aborted = 0;
+static int streaming = 0;   /* The root array starts with an object */
+static Schema* outschema;
+static const char* outdir;
+static int every = 0;       /* Records between checkpoints, 0 for none */
+static int resuming = 0;    /* Input continues inside the root array */
+static long inputbase = 0;  /* Input offset the scanner started at */
+
+/* Last two tokens handed to the parser: a record is complete up to one of them */
+static int lasttype = 0;
+static long lastoffset = 0;
+static long prevoffset = 0;
+
+/* Seconds each stage ran and spent waiting on a ring */
+static double started;
+static double tokenwall, tokenwait;
+static double parsewait;
+static double emitwall, emitwait;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void ringinit(SpscRing* ring, size_t elemsize, unsigned long capacity, unsigned long batch) {
+    memset(ring, 0, sizeof(*ring));
+    ring->slots = malloc(capacity * elemsize);
+    switch (ring->slots != NULL) {
+        case 0:
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+    }
+    ring->elemsize = elemsize;
+    ring->mask = capacity - 1;
+    ring->batch = batch;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->changed, NULL);
+}
+
+static void ringfree(SpscRing* ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->changed);
+}
+
+/* Wake a side sleeping on the ring; the store it waits for is made first */
+static void ringwake(SpscRing* ring) {
+    if (!__atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST)) return;
+    pthread_mutex_lock(&ring->lock);
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void ringflush(SpscRing* ring) {
+    __atomic_store_n(&ring->pubtail, ring->tail, __ATOMIC_SEQ_CST);
+    ringwake(ring);
+}
+
+static void ringrelease(SpscRing* ring) {
+    __atomic_store_n(&ring->pubhead, ring->head, __ATOMIC_SEQ_CST);
+    ringwake(ring);
+}
+
+/* Abort the pipeline, waking the sides waiting on its rings */
+static void abortpipeline() {
+    __atomic_store_n(&aborted, 1, __ATOMIC_SEQ_CST);
+    ringwake(&tokens);
+    ringwake(&records);
+}
+
+/*
+ * Wait until *pos, published by the other side, differs from stale, or the
+ * pipeline is aborted; returns the position seen, or stale when aborted
+ */
+static unsigned long ringwait(SpscRing* ring, unsigned long* pos, unsigned long stale) {
+    unsigned long seen = stale;
+    for (int spins = 0; spins < SPIN_LIMIT; spins++) {
+        if (__atomic_load_n(&aborted, __ATOMIC_RELAXED)) return stale;
+        sched_yield();
+        seen = __atomic_load_n(pos, __ATOMIC_ACQUIRE);
+        if (seen != stale) return seen;
+    }
+    pthread_mutex_lock(&ring->lock);
+    __atomic_add_fetch(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+    while ((seen = __atomic_load_n(pos, __ATOMIC_SEQ_CST)) == stale &&
+           !__atomic_load_n(&aborted, __ATOMIC_SEQ_CST)) {
+        pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+    __atomic_sub_fetch(&ring->sleeping, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ring->lock);
+    return seen;
+}
+
+/*
+ * Append an element, waiting while the ring is full; returns 0 once the
+ * pipeline is aborted. The time the ring stays full, spinning or asleep,
+ * is added to waited.
+ */
+static int ringput(SpscRing* ring, const void* elem, double* waited) {
+    if (ring->tail - ring->headcache > ring->mask) {
+        ring->headcache = __atomic_load_n(&ring->pubhead, __ATOMIC_ACQUIRE);
+        if (ring->tail - ring->headcache > ring->mask) {
+            ringflush(ring);
+            double start = now();
+            while (ring->tail - ring->headcache > ring->mask) {
+                if (__atomic_load_n(&aborted, __ATOMIC_RELAXED)) return 0;
+                ring->headcache = ringwait(ring, &ring->pubhead, ring->headcache);
+            }
+            *waited += now() - start;
+        }
+    }
+    memcpy(ring->slots + (ring->tail & ring->mask) * ring->elemsize, elem, ring->elemsize);
+    ring->tail++;
+    if ((ring->tail & (ring->batch - 1)) == 0) ringflush(ring);
+    return 1;
+}
+
+/* Take the next element, waiting while the ring is empty, as ringput does while it is full */
+static int ringget(SpscRing* ring, void* elem, double* waited) {
+    if (ring->head == ring->tailcache) {
+        ringrelease(ring);
+        ring->tailcache = __atomic_load_n(&ring->pubtail, __ATOMIC_ACQUIRE);
+        if (ring->head == ring->tailcache) {
+            double start = now();
+            while (ring->head == ring->tailcache) {
+                if (__atomic_load_n(&aborted, __ATOMIC_RELAXED)) return 0;
+                ring->tailcache = ringwait(ring, &ring->pubtail, ring->tailcache);
+            }
+            *waited += now() - start;
+        }
+    }
+    memcpy(elem, ring->slots + (ring->head & ring->mask) * ring->elemsize, ring->elemsize);
+    ring->head++;
+    if ((ring->head & (ring->batch - 1)) == 0) ringrelease(ring);
+    return 1;
+}
+
+static void* tokenize(void* arg) {
+    (void)arg;
+    double start = now();
+    double traced = tracing() ? tracetime() : 0;
+    tracethread("tokenize");
+    Token tok;
+    memset(&tok, 0, sizeof(tok));
+    if (resuming) {
+        /* Reopen the root array; the separator before the next record is dropped below */
+        tok.type = '[';
+        tok.loc.first_byte = tok.loc.last_byte = inputbase;
+        ringput(&tokens, &tok, &tokenwait);
+    }
+    do {
+        tok.type = yylex();
+        tok.value = yylval;
+        tok.loc = yylloc;
+        tok.loc.first_byte += inputbase;
+        tok.loc.last_byte += inputbase;
+        if (resuming) {
+            resuming = 0;
+            if (tok.type == ',') continue;
+        }
+        if (!ringput(&tokens, &tok, &tokenwait)) break;
+    } while (tok.type > 0);
+    ringflush(&tokens);
+    tokenwall = now() - start;
+    if (traced) tracespan("tokenize", "thread", traced, NULL, -1);
+    return NULL;
+}
+
+static void* emit(void* arg) {
+    (void)arg;
+    double start = now();
+    double traced = tracing() ? tracetime() : 0;
+    tracethread("emit");
+    createOutputDirectory(outdir);
+    Record rec;
+    while (ringget(&records, &rec, &emitwait) && rec.record) {
+        /* Named as an element of the root table, without reading ->parent, which the parser may be setting */
+        writerecord(outschema, rec.record, rec.index);
+        deleteast(rec.record);
+        if (every && (rec.index + 1) % every == 0) {
+            Checkpoint cp = { rec.offset, rec.index + 1, rec.nextid };
+            syncwriter();
+            savecheckpoint(outschema, outdir, &cp);
+        }
+    }
+    emitwall = now() - start;
+    if (traced) tracespan("emit", "thread", traced, NULL, -1);
+    return NULL;
+}
+
+/*
+ * Start the tokenizer and emitter threads; the caller runs the parser. With
+ * resume, the input is positioned at its offset inside the root array.
+ */
+int startpipeline(Schema* schema, const char* output_dir, int checkpoint_every, Checkpoint* resume) {
+    ringinit(&tokens, sizeof(Token), TOKEN_RING, TOKEN_BATCH);
+    ringinit(&records, sizeof(Record), RECORD_RING, RECORD_BATCH);
+    outschema = schema;
+    outdir = output_dir;
+    every = checkpoint_every;
+    resuming = resume != NULL;
+    inputbase = resume ? resume->offset : 0;
+    lasttype = 0;
+    lastoffset = prevoffset = inputbase;
+    aborted = 0;
+    streaming = resume != NULL;
+    started = now();
+    tokenwait = parsewait = emitwait = 0;
+    if (pthread_create(&tokenizer, NULL, tokenize, NULL) != 0) {
+        ringfree(&tokens);
+        ringfree(&records);
+        return 0;
+    }
+    if (pthread_create(&emitter, NULL, emit, NULL) != 0) {
+        abortpipeline();
+        pthread_join(tokenizer, NULL);
+        ringfree(&tokens);
+        ringfree(&records);
+        return 0;
+    }
+    active = 1;
+    return 1;
+}
+
+int piping() {
+    return active;
+}
+
+/* Next token for the parser */
+int pipetoken(YYSTYPE* value, YYLTYPE* loc) {
+    Token tok;
+    if (!ringget(&tokens, &tok, &parsewait)) return 0;
+    lasttype = tok.type;
+    prevoffset = lastoffset;
+    lastoffset = tok.loc.last_byte;
+    *value = tok.value;
+    *loc = tok.loc;
+    return tok.type;
+}
+
+/* An element of the root array was completed; returns 1 when the emitter took it over */
+int piperecord(ASTNode* record, int index) {
+    if (index == 0) streaming = isobj(record);
+    if (!streaming || !isobj(record)) return 0;
+    /* The parser may already hold the token after the record's closing brace */
+    Record rec = { record, index, lasttype == '}' ? lastoffset : prevoffset, peeknid() };
+    return ringput(&records, &rec, &parsewait);
+}
+
+/*
+ * Wait for the threads after the parser has finished, or abort them when it
+ * failed. Returns 1 when the emitter wrote the rows of the root array, which
+ * then only needs sinkend().
+ */
+int stoppipeline(int ok) {
+    if (!active) return 0;
+    double parsewall = now() - started;
+    if (!ok) abortpipeline();
+    Record end = { NULL, 0, 0, 0 };
+    ringput(&records, &end, &parsewait);
+    ringflush(&records);
+    pthread_join(tokenizer, NULL);
+    pthread_join(emitter, NULL);
+    /* Records an aborted emitter did not get to */
+    Record rec;
+    while (records.head != records.tail) {
+        memcpy(&rec, records.slots + (records.head & records.mask) * records.elemsize, sizeof(rec));
+        deleteast(rec.record);
+        records.head++;
+    }
+    statsstage("tokenize", tokenwall - tokenwait, tokenwall);
+    statsstage("build", parsewall - parsewait, parsewall);
+    statsstage("emit", emitwall - emitwait, emitwall);
+    ringfree(&tokens);
+    ringfree(&records);
+    active = 0;
+    return ok && streaming;
+}
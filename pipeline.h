@@ -0,0 +1,26 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "ast.h"
+#include "schema.h"
+#include "checkpoint.h"
+
+/*
+ * Pipelined execution (--pipeline). The scanner runs on a tokenizer thread
+ * and the elements of a root array of objects are written on an emitter
+ * thread as soon as the parser completes them, so scanning, AST building and
+ * row emission overlap. The stages are connected by lock-free single-producer
+ * single-consumer rings that are published in batches: tokens from the
+ * tokenizer to the parser, completed records from the parser to the emitter.
+ * Tables are discovered while writing, as with --single-pass. Busy time of
+ * each stage is reported by --stats. Checkpoints (see checkpoint.h) are
+ * taken by the emitter between records. A record handed to the emitter is
+ * freed once its rows are written and is not kept in the root array.
+ */
+
+int startpipeline(Schema* schema, const char* output_dir, int checkpoint_every, Checkpoint* resume);
+int piping();
+int piperecord(ASTNode* record, int index);
+int stoppipeline(int ok);
+
+#endif
@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include "profile.h"
+#include "helper.h"
+
+/* HyperLogLog with 2^HLL_BITS registers: about 1.6% standard error in 4 KB a column */
+#define HLL_BITS 12
+#define HLL_SIZE (1 << HLL_BITS)
+
+/* Kinds of values seen in a column */
+#define SEEN_INT 1
+#define SEEN_NUM 2
+#define SEEN_BOOL 4
+#define SEEN_STR 8
+
+typedef struct {
+    long values;            /* Non-null values */
+    long nulls;             /* Missing, null or non-scalar values */
+    int seen;               /* SEEN_* bits */
+    double min, max;        /* Over the numeric values */
+    long maxlen;            /* Longest string, in bytes */
+    unsigned char* hll;     /* Registers, allocated with the first value */
+} ColumnProfile;
+
+static int enabled = 0;
+static ColumnProfile* profiles[MAX_TABLES];     /* MAX_COLUMNS each, allocated when first used */
+
+void startprofile() {
+    enabled = 1;
+}
+
+int profiling() {
+    return enabled;
+}
+
+static ColumnProfile* getprofile(int table, int column) {
+    if (table < 0 || table >= MAX_TABLES || column < 0 || column >= MAX_COLUMNS) return NULL;
+    if (!profiles[table]) {
+        profiles[table] = calloc(MAX_COLUMNS, sizeof(ColumnProfile));
+        if (!profiles[table]) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    return &profiles[table][column];
+}
+
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t hashstr(const char* s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    return mix(h);
+}
+
+static void addvalue(ColumnProfile* p, int kind, uint64_t hash) {
+    if (!p->hll) {
+        p->hll = calloc(HLL_SIZE, 1);
+        if (!p->hll) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    uint64_t rest = hash << HLL_BITS;
+    unsigned char rank = rest ? __builtin_clzll(rest) + 1 : 64 - HLL_BITS + 1;
+    unsigned char* reg = &p->hll[hash >> (64 - HLL_BITS)];
+    if (rank > *reg) *reg = rank;
+    p->seen |= kind;
+    p->values++;
+}
+
+static void addnumber(ColumnProfile* p, double v) {
+    if (!(p->seen & (SEEN_INT | SEEN_NUM)) || v < p->min) p->min = v;
+    if (!(p->seen & (SEEN_INT | SEEN_NUM)) || v > p->max) p->max = v;
+}
+
+/* Add the value written to a column */
+void profilecell(int table, int column, const Cell* cell) {
+    ColumnProfile* p = getprofile(table, column);
+    if (!p) return;
+    switch (cell->type) {
+        case CELL_STR: {
+            const char* s = cell->value.strVal;
+            long len = s ? (long)strlen(s) : 0;
+            if (len > p->maxlen) p->maxlen = len;
+            addvalue(p, SEEN_STR, hashstr(s ? s : ""));
+            break;
+        }
+        case CELL_INT:
+            addnumber(p, (double)cell->value.intVal);
+            addvalue(p, SEEN_INT, mix((uint64_t)cell->value.intVal));
+            break;
+        case CELL_NUM: {
+            double v = cell->value.numVal;
+            uint64_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            addnumber(p, v);
+            addvalue(p, SEEN_NUM, mix(bits ^ 0x9e3779b97f4a7c15ULL));
+            break;
+        }
+        case CELL_BOOL:
+            addvalue(p, SEEN_BOOL, mix(cell->value.boolVal ? 3 : 2));
+            break;
+        default:
+            p->nulls++;
+            break;
+    }
+}
+
+static void mergeprofile(ColumnProfile* into, ColumnProfile* p) {
+    if (p->seen & (SEEN_INT | SEEN_NUM)) {
+        int empty = !(into->seen & (SEEN_INT | SEEN_NUM));
+        if (empty || p->min < into->min) into->min = p->min;
+        if (empty || p->max > into->max) into->max = p->max;
+    }
+    into->values += p->values;
+    into->nulls += p->nulls;
+    into->seen |= p->seen;
+    if (p->maxlen > into->maxlen) into->maxlen = p->maxlen;
+    if (!p->hll) return;
+    if (!into->hll) {
+        into->hll = calloc(HLL_SIZE, 1);
+        if (!into->hll) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < HLL_SIZE; i++) {
+        if (p->hll[i] > into->hll[i]) into->hll[i] = p->hll[i];
+    }
+}
+
+static long distinct(ColumnProfile* p) {
+    if (!p->hll) return 0;
+    double m = HLL_SIZE;
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < HLL_SIZE; i++) {
+        sum += ldexp(1.0, -p->hll[i]);
+        if (!p->hll[i]) zeros++;
+    }
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros) estimate = m * log(m / zeros);
+    long n = lround(estimate);
+    return n > p->values ? p->values : n;
+}
+
+static const char* widened(int seen) {
+    switch (seen) {
+        case 0: return "null";
+        case SEEN_INT: return "integer";
+        case SEEN_INT | SEEN_NUM:
+        case SEEN_NUM: return "number";
+        case SEEN_BOOL: return "boolean";
+        default: return "string";
+    }
+}
+
+static const char* typename(ColumnType type) {
+    switch (type) {
+        case COL_ID: return "id";
+        case COL_FOREIGN_KEY: return "foreign_key";
+        case COL_INDEX: return "index";
+        case COL_INTEGER: return "integer";
+        case COL_NUMBER: return "number";
+        case COL_BOOLEAN: return "boolean";
+        default: return "string";
+    }
+}
+
+/*
+ * Write the profile of every CSV file as JSON. A file shared by tables
+ * with the same name has the columns of its header, the last of them.
+ */
+int writeprofile(Schema* schema, const char* path) {
+    FILE* fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "Error: Could not write profile %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    fprintf(fp, "{\"tables\": [");
+    int first = 1;
+    for (int i = 0; i < schema->table_count; i++) {
+        Table* table = &schema->tables[i];
+        if (gettablei(schema, table->name) != i) continue;
+        int last = i;
+        long rows = 0;
+        for (int j = i; j < schema->table_count; j++) {
+            if (strcmp(schema->tables[j].name, table->name)) continue;
+            last = j;
+            rows += schema->tables[j].rows_written;
+        }
+        Table* header = &schema->tables[last];
+        fprintf(fp, "%s\n  {\"name\": ", first ? "" : ",");
+        putjsonstr(fp, table->name);
+        fprintf(fp, ", \"rows\": %ld, \"columns\": [", rows);
+        for (int c = 0; c < header->column_count; c++) {
+            Column* col = &header->columns[c];
+            /* A name can repeat in a header: match the same occurrence of it */
+            int occurrence = 0;
+            for (int k = 0; k < c; k++) {
+                if (!strcmp(header->columns[k].name, col->name)) occurrence++;
+            }
+            ColumnProfile merged;
+            memset(&merged, 0, sizeof(merged));
+            for (int j = i; j <= last; j++) {
+                Table* other = &schema->tables[j];
+                if (!profiles[j] || strcmp(other->name, table->name)) continue;
+                int n = occurrence;
+                for (int k = 0; k < other->column_count; k++) {
+                    if (!strcmp(other->columns[k].name, col->name) && n-- == 0) {
+                        mergeprofile(&merged, &profiles[j][k]);
+                        break;
+                    }
+                }
+            }
+            fprintf(fp, "%s\n    {\"name\": ", c ? "," : "");
+            putjsonstr(fp, col->name);
+            fprintf(fp, ", \"type\": \"%s\", \"widened\": \"%s\", \"values\": %ld, \"nulls\": %ld",
+                    typename(col->type), widened(merged.seen), merged.values, merged.nulls);
+            if (merged.seen & (SEEN_INT | SEEN_NUM)) {
+                fprintf(fp, ", \"min\": %.17g, \"max\": %.17g", merged.min, merged.max);
+            } else {
+                fprintf(fp, ", \"min\": null, \"max\": null");
+            }
+            fprintf(fp, ", \"distinct\": %ld, \"max_length\": %ld}", distinct(&merged), merged.maxlen);
+            free(merged.hll);
+        }
+        fprintf(fp, "]}");
+        first = 0;
+    }
+    fprintf(fp, "]}\n");
+    int ok = !ferror(fp);
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok) fprintf(stderr, "Error: Could not write profile %s: %s\n", path, strerror(errno));
+    return ok;
+}
+
+void stopprofile() {
+    for (int i = 0; i < MAX_TABLES; i++) {
+        if (!profiles[i]) continue;
+        for (int c = 0; c < MAX_COLUMNS; c++) free(profiles[i][c].hll);
+        free(profiles[i]);
+        profiles[i] = NULL;
+    }
+    enabled = 0;
+}
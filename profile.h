@@ -0,0 +1,21 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "schema.h"
+#include "sink.h"
+
+/*
+ * Column profiles (--profile). While rows are written, each column keeps
+ * its null count, numeric min/max, longest string, the type wide enough
+ * for every value seen and a HyperLogLog sketch of its distinct values, in
+ * memory that does not grow with the input. Tables sharing a CSV file are
+ * merged when the profile is written.
+ */
+
+void startprofile();
+int profiling();
+void profilecell(int table, int column, const Cell* cell);
+int writeprofile(Schema* schema, const char* path);
+void stopprofile();
+
+#endif
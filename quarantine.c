@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "quarantine.h"
+
+static int enabled = 0;
+static int maxerrors = -1;      /* Bad records tolerated, -1 for no limit */
+static long errors = 0;
+static FILE* out = NULL;        /* Quarantine file, NULL to only report on stderr */
+
+/* Input read again with pread: offsets are relative to fdbase */
+static int fd = -1;
+static long fdbase = 0;
+
+/* Input that cannot seek, kept from offset keptbase on as it is read */
+static FILE* source = NULL;
+static char* kept = NULL;
+static size_t head = 0;         /* First byte still kept */
+static size_t len = 0;
+static size_t cap = 0;
+static long keptbase = 0;       /* Offset of kept[head] */
+static int root = 0;            /* First byte of the input: '[' keeps it, 0 before it is read */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Enable recovery; path may be NULL to report bad records on stderr only */
+int startquarantine(const char* path, int max_errors) {
+    enabled = 1;
+    maxerrors = max_errors;
+    if (!path) return 1;
+    out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Could not open quarantine file %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+int recovering() {
+    return enabled;
+}
+
+static ssize_t captureread(void* cookie, char* buf, size_t size) {
+    (void)cookie;
+    size_t n = fread(buf, 1, size, source);
+    if (n == 0) return ferror(source) ? -1 : 0;
+    /* Only the elements of a root array can be quarantined */
+    for (size_t i = 0; !root && i < n; i++) {
+        if (buf[i] != ' ' && buf[i] != '\t' && buf[i] != '\r' && buf[i] != '\n') root = buf[i];
+    }
+    pthread_mutex_lock(&lock);
+    if (root != '[') {
+        keptbase += n;
+        pthread_mutex_unlock(&lock);
+        return n;
+    }
+    if (len + n > cap) {
+        size_t grown = cap ? cap : 65536;
+        while (len + n > grown) grown *= 2;
+        char* buffer = realloc(kept, grown);
+        if (!buffer) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        kept = buffer;
+        cap = grown;
+    }
+    memcpy(kept + len, buf, n);
+    len += n;
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+/*
+ * Input for the scanner when recovering: in itself when its bytes can be
+ * read again, otherwise a stream that keeps what it reads once it starts a
+ * root array. base is the offset of the next byte of in; past 0, in
+ * continues inside the root array.
+ */
+FILE* quarantineinput(FILE* in, long base) {
+    if (!enabled) return in;
+    long pos = ftell(in);
+    if (pos >= 0) {
+        fd = fileno(in);
+        fdbase = pos - base;
+        return in;
+    }
+    source = in;
+    keptbase = base;
+    root = base > 0 ? '[' : 0;
+    cookie_io_functions_t io = { captureread, NULL, NULL, NULL };
+    FILE* fp = fopencookie(NULL, "r", io);
+    return fp ? fp : in;
+}
+
+/* The records before offset are complete: their bytes are no longer needed */
+void quarantinekeep(long offset) {
+    if (!source) return;
+    pthread_mutex_lock(&lock);
+    if (offset > keptbase) {
+        size_t drop = offset - keptbase;
+        if (drop > len - head) drop = len - head;
+        head += drop;
+        keptbase += drop;
+        if (head > len / 2 && head >= 65536) {
+            memmove(kept, kept + head, len - head);
+            len -= head;
+            head = 0;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Write s as the contents of a JSON string */
+static void putjson(FILE* fp, const char* s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            fputc('\\', fp);
+            fputc(c, fp);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+}
+
+/* Quarantine the bytes [start, end) of a bad record; returns 0 once --max-errors is exceeded */
+int quarantine(long start, long end, const char* diagnostic) {
+    errors++;
+    fprintf(stderr, "Warning: Skipped bad record at offset %ld: %s\n", start, diagnostic);
+    if (out) {
+        size_t n = end > start ? end - start : 0;
+        char* record = malloc(n + 1);
+        if (!record) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        size_t got = 0;
+        if (fd >= 0) {
+            ssize_t r = pread(fd, record, n, fdbase + start);
+            got = r > 0 ? (size_t)r : 0;
+        } else if (source) {
+            pthread_mutex_lock(&lock);
+            if (start >= keptbase && end <= keptbase + (long)(len - head)) {
+                memcpy(record, kept + head + (start - keptbase), n);
+                got = n;
+            }
+            pthread_mutex_unlock(&lock);
+        }
+        fprintf(out, "{\"offset\": %ld, \"error\": \"", start);
+        putjson(out, diagnostic, strlen(diagnostic));
+        fputs("\", \"record\": \"", out);
+        putjson(out, record, got);
+        fputs("\"}\n", out);
+        free(record);
+    }
+    if (maxerrors >= 0 && errors > maxerrors) {
+        fprintf(stderr, "Error: More than %d bad records\n", maxerrors);
+        return 0;
+    }
+    return 1;
+}
+
+void stopquarantine() {
+    if (out) fclose(out);
+    out = NULL;
+    free(kept);
+    kept = NULL;
+    head = len = cap = 0;
+    root = 0;
+}
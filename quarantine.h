@@ -0,0 +1,22 @@
+#ifndef QUARANTINE_H
+#define QUARANTINE_H
+
+#include <stdio.h>
+
+/*
+ * Bad record quarantine (--max-errors, --quarantine). When the input is a
+ * root array, a syntax error inside one of its elements skips to the next
+ * element instead of failing the run. The bytes of the skipped element are
+ * written to the quarantine file as one JSON line with their offset and the
+ * diagnostic. Input that cannot be read again (a pipe) is kept in memory
+ * from the start of the element being parsed, when its root is an array.
+ */
+
+int startquarantine(const char* path, int max_errors);
+int recovering();
+FILE* quarantineinput(FILE* in, long base);
+void quarantinekeep(long offset);
+int quarantine(long start, long end, const char* diagnostic);
+void stopquarantine();
+
+#endif
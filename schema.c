@@ -1,8 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <errno.h>
 #include "schema.h"
+#include "naming.h"
 
 /* Create a new schema */
 Schema* makeSchema() {
@@ -48,6 +49,14 @@ void delSchema(Schema* schema) {
 
             j++;
         }
+        freeentities(&table->entities);
+        freeentities(&table->subtrees);
+        j = 0;
+        while (j < table->plan_columns) {
+            free(table->plan[j].key);
+            j++;
+        }
+        free(table->plan);
         i++;
     }
     free(schema);
@@ -68,6 +77,8 @@ int addT(Schema* schema, const char* name, int is_junction, int is_child) {
     schema->tables[table_index].signature = NULL;
     schema->tables[table_index].is_junction = is_junction;
     schema->tables[table_index].is_child = is_child;
+    schema->tables[table_index].natural_key = naturalkey(name);
+    if (schema->tables[table_index].natural_key) schema->keyed_tables++;
     addC(schema, table_index, "id", COL_ID, NULL);
     return table_index;
 }
@@ -173,109 +184,12 @@ int getibysig(Schema* schema, const char* signature) {
     return -1;
 }
 
-char* tolowercase(const char* str) {
-    size_t len = strlen(str);
-    char* lower = malloc(len + 1);
-    if (!lower) return NULL;
-    
-    for (size_t i = 0; i < len; i++) {
-        lower[i] = tolower(str[i]);
-    }
-    lower[len] = '\0';
-    return lower;
-}
-
-int endswiths(const char* str) {
-    size_t len = strlen(str);
-    return len > 0 && str[len - 1] == 's';
-}
-
-char* predicttablename(ASTNode* obj, const char* parent_key, const char* default_name) {
-    if (parent_key) {
-        switch (1) {
-            case 1:
-                if (strcmp(parent_key, "author") == 0 || strcmp(parent_key, "comments") == 0) {
-                    ASTNode* uid_node = getbyname(obj, "uid");
-                    if (uid_node && uid_node->type == nodestr) {
-                        return strdup("users");
-                    }
-                }
-                break;
-            case 2:
-                if (strcmp(parent_key, "posts") == 0 || 
-                    (obj->parent && obj->parent->type == nodeobj && 
-                     getbyname(obj->parent, "postId") != NULL)) {
-                    return strdup("posts");
-                }
-                break;
-            case 3:
-                if (strcmp(parent_key, "comments") == 0) {
-                    return strdup("comments");
-                }
-                break;
-            case 4:
-                if (strcmp(parent_key, "customer") == 0) {
-                    return strdup("customers");
-                }
-                break;
-            case 5:
-                if (strcmp(parent_key, "items") == 0) {
-                    if (obj->parent && obj->parent->type == nodeobj) {
-                        if (getbyname(obj->parent, "orderId") != NULL || 
-                            getbyname(obj->parent, "order_id") != NULL) {
-                            return strdup("orderitems");
-                        }
-                        if ((getbyname(obj->parent, "total") != NULL ||
-                             getbyname(obj->parent, "amount") != NULL) &&
-                            (getbyname(obj->parent, "date") != NULL || 
-                             getbyname(obj->parent, "orderDate") != NULL)) {
-                            return strdup("orderitems");
-                        }
-                    }
-                    if (obj && obj->type == nodeobj) {
-                        int has_sku = (getbyname(obj, "sku") != NULL);
-                        int has_qty = (getbyname(obj, "qty") != NULL || 
-                                      getbyname(obj, "quantity") != NULL);
-
-                        if (has_sku && has_qty) {
-                            return strdup("orderitems");
-                        }
-                    }
-                }
-                break;
-        }
-    }
-    if (obj && getbyname(obj, "postId") != NULL) {
-        return strdup("posts");
-    }
-    const char* id_fields[] = {"type", "kind", "name", "category", "class", NULL};
-    if (isobj(obj)) {
-        int i = 0;
-        while (id_fields[i] != NULL) {
-            ASTNode* id_node = getbyname(obj, id_fields[i]);
-            if (id_node && id_node->type == nodestr) {
-                char* name = tolowercase(id_node->value.strVal);
-                if (name[0] && !endswiths(name)) {
-                    char* plural = malloc(strlen(name) + 2);
-                    sprintf(plural, "%ss", name);
-                    free(name);
-                    return plural;
-                }
-                return name;
-            }
-            i++;
-        }
-    }
-    if (parent_key) {
-        char* name = tolowercase(parent_key);
-        if (strcmp(name, "author") == 0) {
-            free(name);
-            return strdup("users");
-        }
-        return name;
+/* Table of an object by the hash of its signature, without building the signature */
+int getibyshape(Schema* schema, unsigned long shape) {
+    for (int i = 0; i < schema->table_count; i++) {
+        if (schema->tables[i].signature && schema->tables[i].shape == shape) return i;
     }
-
-    return strdup(default_name);
+    return -1;
 }
 
 void processScalar(Schema* schema, ASTNode* array, const char* parent_table, 
@@ -310,22 +224,23 @@ void processOrderItems(Schema* schema, ASTNode* value) {
     } else {
         items_table_index = gettablei(schema, "order_items");
     }
-    for (int j = 0; j < value->value.array.elemCount; j++) {
-        ASTNode* item = value->value.array.elements[j];
+    for (int j = 0; j < getcount(value); j++) {
+        ASTNode* item = getchild(value, j);
         if (isobj(item)) {
-            for (int k = 0; k < item->value.object.pairCount; k++) {
-                KeyValuePair* item_pair = item->value.object.pairs[k];
-                if (scalar(item_pair->value)) {
+            for (int k = 0; k < getcount(item); k++) {
+                char* key = getkey(item, k);
+                ASTNode* item_value = getchild(item, k);
+                if (scalar(item_value)) {
                     ColumnType col_type;
-                    switch(item_pair->value->type) {
+                    switch(nodetype(item_value)) {
                         case nodestr: col_type = COL_STRING; break;
                         case nodeint: col_type = COL_INTEGER; break;
                         case nodenum: col_type = COL_NUMBER; break;
                         case nodebool: col_type = COL_BOOLEAN; break;
                         default: col_type = COL_STRING; break;
                     }
-                    if (!colexist(schema, items_table_index, item_pair->key)) {
-                        addC(schema, items_table_index, item_pair->key, col_type, NULL);
+                    if (!colexist(schema, items_table_index, key)) {
+                        addC(schema, items_table_index, key, col_type, NULL);
                     }
                 }
             }
@@ -333,107 +248,116 @@ void processOrderItems(Schema* schema, ASTNode* value) {
     }
 }
 
-void processArray(Schema* schema, ASTNode* value, ASTNode* obj, int table_index, const char* key) {
-    if (value->value.array.elemCount > 0) {
-        ASTNode* first = value->value.array.elements[0];
-        if (scalar(first)) {
-            processScalar(schema, value, schema->tables[table_index].name, obj->node_id, key);
-        } else if (isobj(first)) {
-            if (strcmp(key, "items") == 0 && strcmp(schema->tables[table_index].name, "orders") == 0) {
-                processOrderItems(schema, value);
-            } else {
-                for (int j = 0; j < value->value.array.elemCount; j++) {
-                    ASTNode* item = value->value.array.elements[j];
-                    if (isobj(item)) {
-                        processobj(schema, item, schema->tables[table_index].name, obj->node_id, j);
-                    }
-                }
-            }
+/* An object whose columns are being added, with the child being visited */
+typedef struct {
+    ASTNode* obj;
+    int table_index;
+    int pair;       /* Next pair to visit */
+    int elem;       /* Next array element, or 1 once an object child was visited */
+} SchemaFrame;
+
+/* Add the columns of obj's table; with descend set, child shapes get their tables too */
+void addcolumns(Schema* schema, ASTNode* obj, int table_index, int descend) {
+    FrameStack stack;
+    initframes(&stack, sizeof(SchemaFrame));
+    SchemaFrame* root = pushframe(&stack);
+    root->obj = obj;
+    root->table_index = table_index;
+    while (stack.count > 0) {
+        SchemaFrame* frame = topframe(&stack);
+        ASTNode* cur = frame->obj;
+        if (frame->pair >= getcount(cur)) {
+            popframe(&stack);
+            continue;
         }
-    }
-}
-
-void addColumnsForObject(Schema* schema, ASTNode* obj, int table_index) {
-    for (int i = 0; i < obj->value.object.pairCount; i++) {
-        KeyValuePair* pair = obj->value.object.pairs[i];
-        ASTNode* value = pair->value;
+        char* key = getkey(cur, frame->pair);
+        ASTNode* value = getchild(cur, frame->pair);
+        const char* table_name = schema->tables[frame->table_index].name;
+        ASTNode* child = NULL;
+        int child_index = -1;
 
         if (scalar(value)) {
-            if (strcmp(schema->tables[table_index].name, "comments") == 0 && strcmp(pair->key, "uid") == 0) {
+            frame->pair++;
+            if (strcmp(table_name, "comments") == 0 && strcmp(key, "uid") == 0) {
                 continue;
             }
             ColumnType col_type;
-            switch (value->type) {
+            switch (nodetype(value)) {
                 case nodestr: col_type = COL_STRING; break;
                 case nodeint: col_type = COL_INTEGER; break;
                 case nodenum: col_type = COL_NUMBER; break;
                 case nodebool: col_type = COL_BOOLEAN; break;
                 default: col_type = COL_STRING; break;
             }
-            addC(schema, table_index, pair->key, col_type, NULL);
+            addC(schema, frame->table_index, key, col_type, NULL);
         } else if (isobj(value)) {
-            processobj(schema, value, schema->tables[table_index].name, 0, -1);
-            char fk_name[256];
-            sprintf(fk_name, "%s_id", pair->key);
-            addC(schema, table_index, fk_name, COL_FOREIGN_KEY, pair->key);
-        } else if (isArray(value)) {
-            processArray(schema, value, obj, table_index, pair->key);
-        }
-    }
-}
-
-char* predicttablename_for_child(ASTNode* obj, const char* parent_key, const char* parent_table) {
-    char* table_name = predicttablename(obj, parent_key, parent_table);
-
-    if (strcmp(parent_key, "items") == 0) {
-        int has_sku = 0;
-        int has_qty_or_quantity = 0;
-        int has_price = 0;
-
-        for (int i = 0; i < obj->value.object.pairCount; i++) {
-            const char* key = obj->value.object.pairs[i]->key;
-            if (strcmp(key, "sku") == 0) has_sku = 1;
-            if (strcmp(key, "qty") == 0 || strcmp(key, "quantity") == 0) has_qty_or_quantity = 1;
-            if (strcmp(key, "price") == 0) has_price = 1;
+            /* Visit the child first, then come back for its foreign key */
+            if (!frame->elem) {
+                frame->elem = 1;
+                child = value;
+            } else {
+                frame->elem = 0;
+                frame->pair++;
+                char fk_name[256];
+                sprintf(fk_name, "%s_id", key);
+                addC(schema, frame->table_index, fk_name, COL_FOREIGN_KEY, key);
+            }
+        } else if (isArray(value) && getcount(value) > 0) {
+            ASTNode* first = getchild(value, 0);
+            if (scalar(first)) {
+                frame->pair++;
+                processScalar(schema, value, table_name, getnodeID(cur), key);
+            } else if (isobj(first) && strcmp(key, "items") == 0 && strcmp(table_name, "orders") == 0) {
+                frame->pair++;
+                processOrderItems(schema, value);
+            } else if (isobj(first) && !descend) {
+                frame->pair++;
+            } else if (isobj(first)) {
+                while (frame->elem < getcount(value) && !child) {
+                    ASTNode* item = getchild(value, frame->elem);
+                    if (isobj(item)) {
+                        child = item;
+                        child_index = frame->elem;
+                    }
+                    frame->elem++;
+                }
+                if (!child) {
+                    frame->elem = 0;
+                    frame->pair++;
+                }
+            } else {
+                frame->pair++;
+            }
+        } else {
+            frame->pair++;
         }
 
-        if (has_sku && (has_qty_or_quantity || has_price)) {
-            free(table_name);
-            table_name = strdup("order_items");
+        if (child && descend) {
+            int child_table = beginobj(schema, child, table_name, child_index < 0 ? key : NULL, child_index);
+            if (child_table >= 0) {
+                SchemaFrame* next = pushframe(&stack);
+                next->obj = child;
+                next->table_index = child_table;
+            }
         }
     }
-    return table_name;
+    freeframes(&stack);
 }
 
-char* determineTableName(Schema* schema, ASTNode* obj, const char* parent_table, int array_index) {
-    char* table_name = NULL;
+void addColumnsForObject(Schema* schema, ASTNode* obj, int table_index) {
+    addcolumns(schema, obj, table_index, 1);
+}
+
+/*
+ * Name the table of an object whose shape is new, by the naming rules.
+ * parent_key is the key the object is the value of, NULL for an array element.
+ */
+char* determineTableName(Schema* schema, ASTNode* obj, const char* parent_table, const char* parent_key,
+                         const char* signature) {
     if (!parent_table) {
-        if (getbyname(obj, "postId")) {
-            table_name = strdup("posts");
-        } else if (getbyname(obj, "orderId") || getbyname(obj, "order_id")) {
-            table_name = strdup("orders");
-        } else if (getbyname(obj, "items") && (getbyname(obj, "total") || getbyname(obj, "customer"))) {
-            table_name = strdup("orders");
-        } else {
-            table_name = strdup("root");
-        }
-    } else {
-        const char* parent_key = NULL;
-        if (obj->parent && obj->parent->type == nodeobj) {
-            for (int i = 0; i < obj->parent->value.object.pairCount; i++) {
-                if (obj->parent->value.object.pairs[i]->value == obj) {
-                    parent_key = obj->parent->value.object.pairs[i]->key;
-                    break;
-                }
-            }
-        }
-        if (parent_key) {
-            table_name = predicttablename_for_child(obj, parent_key, parent_table);
-        } else {
-            table_name = strdup(parent_table);
-        }
+        return nametable(obj, NAME_ROOT, NULL, NULL, signature);
     }
-    return table_name;
+    return nametable(obj, parent_key ? NAME_KEY : NAME_ELEM, parent_key, parent_table, signature);
 }
 
 void processAuthor(Schema* schema, ASTNode* obj, int posts_table_index) {
@@ -445,13 +369,13 @@ void processAuthor(Schema* schema, ASTNode* obj, int posts_table_index) {
             addC(schema, users_table_index, "uid", COL_STRING, NULL);
             addC(schema, users_table_index, "name", COL_STRING, NULL);
         }
-        processobj(schema, author, "posts", 0, -1);
+        processobj(schema, author, "posts", "author", 0, -1);
     }
 }
 
 void processComments(Schema* schema, ASTNode* obj) {
     ASTNode* comments = getbyname(obj, "comments");
-    if (comments && isArray(comments) && comments->value.array.elemCount > 0) {
+    if (comments && isArray(comments) && getcount(comments) > 0) {
         if (!exists(schema, "comments")) {
             int comments_table_index = addT(schema, "comments", 0, 1);
             addC(schema, comments_table_index, "post_id", COL_FOREIGN_KEY, "posts");
@@ -459,10 +383,10 @@ void processComments(Schema* schema, ASTNode* obj) {
             addC(schema, comments_table_index, "user_id", COL_FOREIGN_KEY, "users");
             addC(schema, comments_table_index, "text", COL_STRING, NULL);
         }
-        for (int i = 0; i < comments->value.array.elemCount; i++) {
-            ASTNode* comment = comments->value.array.elements[i];
+        for (int i = 0; i < getcount(comments); i++) {
+            ASTNode* comment = getchild(comments, i);
             if (isobj(comment)) {
-                processobj(schema, comment, "comments", 0, i);
+                processobj(schema, comment, "comments", NULL, 0, i);
             }
         }
     }
@@ -478,12 +402,12 @@ void processPostsRoot(Schema* schema, ASTNode* obj) {
     }
 }
 
-void processobj(Schema* schema, ASTNode* obj, const char* parent_table, 
-                long parent_id, int array_index) {
-    if (!isobj(obj)) return;
+/* Create the table for an object whose shape is new; returns -1 when there is nothing to visit */
+int beginobj(Schema* schema, ASTNode* obj, const char* parent_table, const char* parent_key, int array_index) {
+    if (!isobj(obj)) return -1;
     if (getbyname(obj, "postId") != NULL && !parent_table) {
         processPostsRoot(schema, obj);
-        return;
+        return -1;
     }
     char* signature = getsig(obj);
     int table_index = -1;
@@ -491,45 +415,68 @@ void processobj(Schema* schema, ASTNode* obj, const char* parent_table,
     if (signature) {
         table_index = getibysig(schema, signature);
     }
-    if (table_index == -1) {
-        table_name = determineTableName(schema, obj, parent_table, array_index);
-        if (strcmp(table_name, "users") == 0 && exists(schema, "users")) {
-            free(table_name);
-            free(signature);
-            return;
-        }
-        int is_child = (array_index >= 0);
-        table_index = addT(schema, table_name, 0, is_child);
+    if (table_index != -1) {
+        free(signature); 
+        return -1;
+    }
+    table_name = determineTableName(schema, obj, parent_table, parent_key, signature);
+    if (strcmp(table_name, "users") == 0 && exists(schema, "users")) {
         free(table_name);
-        schema->tables[table_index].signature = signature;
-        if (is_child && parent_table) {
-            char fk_name[256];
-            sprintf(fk_name, "%s_id", parent_table);
-            addC(schema, table_index, fk_name, COL_FOREIGN_KEY, parent_table);
-            addC(schema, table_index, "seq", COL_INDEX, NULL);
-
-            if (strcmp(schema->tables[table_index].name, "comments") == 0) {
-                addC(schema, table_index, "user_id", COL_FOREIGN_KEY, "users");
-            }
+        free(signature);
+        return -1;
+    }
+    int is_child = (array_index >= 0);
+    table_index = addT(schema, table_name, 0, is_child);
+    free(table_name);
+    if (table_index < 0) {
+        free(signature);
+        return -1;
+    }
+    schema->tables[table_index].signature = signature;
+    schema->tables[table_index].shape = sigshape(signature);
+    if (is_child && parent_table) {
+        char fk_name[256];
+        sprintf(fk_name, "%s_id", parent_table);
+        addC(schema, table_index, fk_name, COL_FOREIGN_KEY, parent_table);
+        addC(schema, table_index, "seq", COL_INDEX, NULL);
+
+        if (strcmp(schema->tables[table_index].name, "comments") == 0) {
+            addC(schema, table_index, "user_id", COL_FOREIGN_KEY, "users");
         }
+    }
+    return table_index;
+}
+
+void processobj(Schema* schema, ASTNode* obj, const char* parent_table, const char* parent_key,
+                long parent_id, int array_index) {
+    int table_index = beginobj(schema, obj, parent_table, parent_key, array_index);
+    if (table_index >= 0) {
         addColumnsForObject(schema, obj, table_index);
-    } else {
-        free(signature); 
     }
 }
 
+/* Create the table for a single object without visiting its children (--single-pass) */
+int discoverobj(Schema* schema, ASTNode* obj, const char* parent_table, const char* parent_key,
+                int array_index) {
+    int table_index = beginobj(schema, obj, parent_table, parent_key, array_index);
+    if (table_index >= 0) {
+        addcolumns(schema, obj, table_index, 0);
+    }
+    return table_index;
+}
+
 void processArrayItems(Schema* schema, ASTNode* ast) {
-    for (int i = 0; i < ast->value.array.elemCount; i++) {
-        ASTNode* item = ast->value.array.elements[i];
+    for (int i = 0; i < getcount(ast); i++) {
+        ASTNode* item = getchild(ast, i);
         if (isobj(item)) {
-            processobj(schema, item, "root", 0, i);
+            processobj(schema, item, "root", NULL, 0, i);
         }
     }
 }
 
 void handleArray(Schema* schema, ASTNode* ast) {
-    if (ast->value.array.elemCount > 0) {
-        ASTNode* first = ast->value.array.elements[0];
+    if (getcount(ast) > 0) {
+        ASTNode* first = getchild(ast, 0);
         if (isobj(first)) {
             processArrayItems(schema, ast);
         } else {
@@ -542,7 +489,7 @@ void genSchema(Schema* schema, ASTNode* ast) {
     if (!schema || !ast) return;
 
     if (isobj(ast)) {
-        processobj(schema, ast, NULL, 0, -1);
+        processobj(schema, ast, NULL, NULL, 0, -1);
     } else if (isArray(ast)) {
         handleArray(schema, ast);
     }
@@ -600,3 +547,178 @@ void printschema(Schema* schema) {
     }
 }
 
+
+/* Write a string as <length>:<bytes>, or - for NULL */
+static void putfield(FILE* fp, const char* s) {
+    if (!s) {
+        fputs(" -", fp);
+        return;
+    }
+    fprintf(fp, " %zu:", strlen(s));
+    fputs(s, fp);
+}
+
+/* Read a field written by putfield; *ok is cleared on malformed input */
+static char* getfield(FILE* fp, int* ok) {
+    int c;
+    while ((c = getc(fp)) == ' ');
+    if (c == '-') return NULL;
+    ungetc(c, fp);
+    size_t len;
+    if (fscanf(fp, "%zu:", &len) != 1) {
+        *ok = 0;
+        return NULL;
+    }
+    char* s = malloc(len + 1);
+    if (!s || fread(s, 1, len, fp) != len) {
+        free(s);
+        *ok = 0;
+        return NULL;
+    }
+    s[len] = '\0';
+    return s;
+}
+
+/*
+ * Serialize the schema. With runstate, the state of a run in progress is
+ * included: the header written for each table, its row count, the natural
+ * keys and --dedup-subtrees subtrees already written and the next id for
+ * rows without an AST node.
+ */
+void saveschema(Schema* schema, FILE* fp, int runstate) {
+    fprintf(fp, "schema 1\nrowid %ld\n", runstate ? schema->next_row_id : 0);
+    for (int i = 0; i < schema->table_count; i++) {
+        Table* table = &schema->tables[i];
+        fputs("table", fp);
+        putfield(fp, table->name);
+        putfield(fp, table->signature);
+        if (runstate) {
+            fprintf(fp, " %d %d %d %ld %d %d\n", table->is_junction, table->is_child,
+                    table->header_columns, table->rows_written, table->column_count, table->entities.count);
+        } else {
+            fprintf(fp, " %d %d 0 0 %d 0\n", table->is_junction, table->is_child, table->column_count);
+        }
+        for (int j = 0; j < table->column_count; j++) {
+            Column* col = &table->columns[j];
+            fputs("column", fp);
+            putfield(fp, col->name);
+            fprintf(fp, " %d", col->type);
+            putfield(fp, col->references);
+            fputc('\n', fp);
+        }
+        for (int b = 0; runstate && b < table->entities.capacity; b++) {
+            for (EntityEntry* e = table->entities.buckets[b]; e; e = e->next) {
+                fputs("entity", fp);
+                putfield(fp, e->key);
+                fprintf(fp, " %ld\n", e->row_id);
+            }
+        }
+        for (int b = 0; runstate && b < table->subtrees.capacity; b++) {
+            for (EntityEntry* e = table->subtrees.buckets[b]; e; e = e->next) {
+                fputs("subtree", fp);
+                putfield(fp, e->key);
+                fprintf(fp, " %ld\n", e->row_id);
+            }
+        }
+    }
+    fputs("end\n", fp);
+}
+
+/* Load a schema written by saveschema into an empty one; returns 0 on malformed input */
+int loadschema(Schema* schema, FILE* fp) {
+    int version;
+    if (fscanf(fp, " schema %d rowid %ld ", &version, &schema->next_row_id) != 2 || version != 1) return 0;
+    char word[16];
+    int ok = 1;
+    Table* table = NULL;
+    while (ok && fscanf(fp, "%15s", word) == 1) {
+        if (strcmp(word, "end") == 0) return 1;
+        if (strcmp(word, "subtree") == 0 && table) {
+            /* Subtrees written by --dedup-subtrees follow their table */
+            long row_id;
+            unsigned long hash;
+            char* key = getfield(fp, &ok);
+            if (ok) ok = key && sscanf(key, "%16lx", &hash) == 1 && fscanf(fp, "%ld", &row_id) == 1;
+            if (ok) addhashed(&table->subtrees, hash, key, row_id);
+            free(key);
+            continue;
+        }
+        if (strcmp(word, "table") != 0) return 0;
+        char* name = getfield(fp, &ok);
+        char* signature = getfield(fp, &ok);
+        int junction, child, header, columns, entities;
+        long rows;
+        if (!ok || !name || fscanf(fp, "%d %d %d %ld %d %d", &junction, &child, &header, &rows,
+                                   &columns, &entities) != 6) {
+            free(name);
+            free(signature);
+            return 0;
+        }
+        int table_index = addT(schema, name, junction, child);
+        free(name);
+        if (table_index < 0) {
+            free(signature);
+            return 0;
+        }
+        table = &schema->tables[table_index];
+        table->signature = signature;
+        if (signature) table->shape = sigshape(signature);
+        table->header_columns = header;
+        table->rows_written = rows;
+        for (int j = 0; ok && j < columns; j++) {
+            int type;
+            char* colname = NULL;
+            char* references = NULL;
+            ok = fscanf(fp, "%15s", word) == 1 && strcmp(word, "column") == 0;
+            if (ok) colname = getfield(fp, &ok);
+            if (ok) ok = colname && fscanf(fp, "%d", &type) == 1;
+            if (ok) references = getfield(fp, &ok);
+            /* addT created the id column */
+            if (ok && j > 0) addC(schema, table_index, colname, (ColumnType)type, references);
+            free(colname);
+            free(references);
+        }
+        for (int j = 0; ok && j < entities; j++) {
+            long row_id;
+            char* key = NULL;
+            ok = fscanf(fp, "%15s", word) == 1 && strcmp(word, "entity") == 0;
+            if (ok) key = getfield(fp, &ok);
+            if (ok) ok = key && fscanf(fp, "%ld", &row_id) == 1;
+            if (ok) addentity(&table->entities, key, row_id);
+            free(key);
+        }
+    }
+    return 0;
+}
+
+/* Write the tables of a run for --schema-out, without its run state */
+int writemanifest(Schema* schema, const char* path) {
+    FILE* fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "Error: Could not write schema manifest %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    fputs("manifest 1\n", fp);
+    saveschema(schema, fp, 0);
+    return fclose(fp) == 0;
+}
+
+/* Load the tables written by --schema-out into an empty schema (--schema-in) */
+int readmanifest(Schema* schema, const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error: Could not read schema manifest %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    int version;
+    long rowid = schema->next_row_id;
+    int ok = fscanf(fp, "manifest %d", &version) == 1 && version == 1 && loadschema(schema, fp);
+    fclose(fp);
+    schema->next_row_id = rowid;
+    if (!ok) {
+        fprintf(stderr, "Error: Malformed schema manifest %s\n", path);
+        return 0;
+    }
+    schema->manifest = 1;
+    return 1;
+}
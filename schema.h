@@ -1,7 +1,9 @@
 #ifndef SCHEMA_H
 #define SCHEMA_H
 
+#include <stdio.h>
 #include "ast.h"
+#include "entity.h"
 
 /* Maximum number of tables we can track */
 #define MAX_TABLES 100
@@ -27,20 +29,43 @@ typedef struct {
     char* references;   /* For foreign keys, the table it references */
 } Column;
 
+/* How one column of a row is filled, compiled from its Column */
+typedef struct {
+    ColumnType type;
+    const char* references;     /* Foreign keys: the table it references */
+    char* key;                  /* Key of the source value, NULL when there is none */
+    int slot;                   /* Position of key in the last object it was found in */
+} RowStep;
+
 /* Table schema */
 typedef struct {
     char* name;                 /* Table name */
     Column columns[MAX_COLUMNS]; /* Column definitions */
     int column_count;           /* Number of columns */
     char* signature;            /* Object signature for this table (if from objects) */
+    unsigned long shape;        /* Hash of the signature, see getshape */
     int is_junction;            /* True if this is a junction table (for array of scalars) */
     int is_child;               /* True if this is a child table (for array of objects) */
+    long rows_written;          /* Rows emitted to the CSV file */
+    long bytes_written;         /* Size of the CSV file after emission */
+    int file_opens;             /* Number of times the CSV file was opened */
+    int header_columns;         /* Columns in the written CSV header, 0 before the file exists */
+    const char* natural_key;    /* Field identifying an entity (--natural-key), or NULL */
+    EntityIndex entities;       /* Natural key values already written */
+    EntityIndex subtrees;       /* Subtrees already written by Merkle hash, with --dedup-subtrees */
+    RowStep* plan;              /* Compiled row plan for the default row writer */
+    int plan_columns;           /* Columns the plan was compiled for */
 } Table;
 
 /* Schema manager */
 typedef struct {
     Table tables[MAX_TABLES];   /* All tables in the schema */
     int table_count;            /* Number of tables */
+    int discover;               /* Create tables while writing rows (--single-pass) */
+    int keyed_tables;           /* Tables with a natural key */
+    long next_row_id;           /* Next id for rows without an AST node, 0 to continue the AST ids */
+    int manifest;               /* Tables were loaded with --schema-in */
+    int dedup;                  /* Write identical subtrees once (--dedup-subtrees) */
 } Schema;
 
 Schema* makeSchema();
@@ -53,7 +78,17 @@ int colexist(Schema* schema, int table_index, const char* name);
 int tableexists(Schema* schema, const char* signature);
 int gettablei(Schema* schema, const char* name);
 int getibysig(Schema* schema, const char* signature);
+int getibyshape(Schema* schema, unsigned long shape);
 void printschema(Schema* schema);
-void processobj(Schema* schema, ASTNode* obj, const char* parent_table, long parent_id, int array_index);
+void saveschema(Schema* schema, FILE* fp, int runstate);
+int loadschema(Schema* schema, FILE* fp);
+int writemanifest(Schema* schema, const char* path);
+int readmanifest(Schema* schema, const char* path);
+int beginobj(Schema* schema, ASTNode* obj, const char* parent_table, const char* parent_key, int array_index);
+void processobj(Schema* schema, ASTNode* obj, const char* parent_table, const char* parent_key,
+                long parent_id, int array_index);
+int discoverobj(Schema* schema, ASTNode* obj, const char* parent_table, const char* parent_key,
+                int array_index);
+void processScalar(Schema* schema, ASTNode* array, const char* parent_table, long parent_id, const char* parent_key);
 
 #endif 
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "select.h"
+
+/* One step of a pattern */
+typedef struct {
+    char* key;          /* Key to match, NULL for any key */
+    int element;        /* Matches array elements ([*]) instead of keys */
+} SelStep;
+
+typedef struct {
+    SelStep* steps;
+    int count;
+} SelPattern;
+
+/* Match state of an open object or array */
+typedef struct {
+    unsigned long alive;    /* Patterns matching the path so far */
+    int full;               /* Some pattern matched completely: keep everything below */
+    int isarray;
+} SelState;
+
+static SelPattern patterns[MAX_SELECT];
+static int patterncount = 0;
+static FrameStack states = { NULL, sizeof(SelState), 0, 0 };
+static SelState pending;    /* State of the value following the last key */
+
+static void freepattern(SelPattern* pat) {
+    for (int i = 0; i < pat->count; i++) free(pat->steps[i].key);
+    free(pat->steps);
+    pat->steps = NULL;
+    pat->count = 0;
+}
+
+/* Parse a pattern such as $.a.b[*].* */
+int addselect(const char* pattern) {
+    if (patterncount >= MAX_SELECT) {
+        fprintf(stderr, "Error: at most %d --select patterns are supported\n", MAX_SELECT);
+        return 0;
+    }
+    if (pattern[0] != '$') return 0;
+    SelPattern* pat = &patterns[patterncount];
+    pat->steps = NULL;
+    pat->count = 0;
+    const char* p = pattern + 1;
+    while (*p) {
+        SelStep step = { NULL, 0 };
+        if (strncmp(p, "[*]", 3) == 0) {
+            step.element = 1;
+            p += 3;
+        } else if (*p == '.') {
+            p++;
+            size_t len = strcspn(p, ".[");
+            if (len == 0) {
+                freepattern(pat);
+                return 0;
+            }
+            if (len != 1 || *p != '*') step.key = strndup(p, len);
+            p += len;
+        } else {
+            freepattern(pat);
+            return 0;
+        }
+        SelStep* steps = realloc(pat->steps, (pat->count + 1) * sizeof(SelStep));
+        if (!steps) {
+            free(step.key);
+            freepattern(pat);
+            return 0;
+        }
+        pat->steps = steps;
+        pat->steps[pat->count++] = step;
+    }
+    patterncount++;
+    return 1;
+}
+
+int selecting() {
+    return patterncount > 0;
+}
+
+/* Follow a key (or an array element when key is NULL) from the state of its container */
+static SelState step(SelState* from, const char* key, int index) {
+    SelState next = { 0, from->full, 0 };
+    if (next.full) return next;
+    for (int i = 0; i < patterncount; i++) {
+        if (!(from->alive & (1UL << i)) || index >= patterns[i].count) continue;
+        SelStep* s = &patterns[i].steps[index];
+        int match = key ? !s->element && (!s->key || strcmp(s->key, key) == 0) : s->element;
+        if (!match) continue;
+        next.alive |= 1UL << i;
+        if (index + 1 == patterns[i].count) next.full = 1;
+    }
+    return next;
+}
+
+static int dead(SelState* state) {
+    return !state->full && !state->alive;
+}
+
+/* A key was read; returns 0 when its value is to be skipped */
+int selkey(const char* key) {
+    if (!patterncount) return 1;
+    pending = step(topframe(&states), key, states.count - 1);
+    return !dead(&pending);
+}
+
+/* An object or array starts */
+void selopen(int isarray) {
+    if (!patterncount) return;
+    SelState cur;
+    SelState* top = topframe(&states);
+    if (!top) {
+        cur.alive = patterncount < 64 ? (1UL << patterncount) - 1 : ~0UL;
+        cur.full = 0;
+        for (int i = 0; i < patterncount; i++) {
+            if (patterns[i].count == 0) cur.full = 1;
+        }
+    } else if (top->isarray) {
+        cur = step(top, NULL, states.count - 1);
+    } else {
+        cur = pending;
+    }
+    cur.isarray = isarray;
+    *(SelState*)pushframe(&states) = cur;
+}
+
+void selclose() {
+    popframe(&states);
+}
+
+/* True when the elements of the current array are outside every pattern */
+int seldropelem() {
+    if (!patterncount) return 0;
+    SelState elem = step(topframe(&states), NULL, states.count - 1);
+    return dead(&elem);
+}
+
+void freeselect() {
+    for (int i = 0; i < patterncount; i++) {
+        freepattern(&patterns[i]);
+    }
+    patterncount = 0;
+    freeframes(&states);
+}
@@ -0,0 +1,22 @@
+#ifndef SELECT_H
+#define SELECT_H
+
+/*
+ * Projection pushdown (--select). Patterns are JSON paths such as
+ * $.customer.orders[*] or $.store.*.name: '.key' matches an object key, '.*'
+ * any key and '[*]' any array element. A value is kept when its path lies on
+ * the way to a pattern or inside a matched subtree; everything else is skipped
+ * by the scanner without building AST nodes.
+ */
+
+#define MAX_SELECT 64
+
+int addselect(const char* pattern);
+int selecting();
+int selkey(const char* key);
+void selopen(int isarray);
+void selclose();
+int seldropelem();
+void freeselect();
+
+#endif
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "shard.h"
+
+typedef struct {
+    int current;        /* Shard rows go to when rolling over */
+    int used;           /* Shards created, the last one plus one */
+    int capacity;
+    int* header;        /* Columns in the header of each shard, 0 before it exists */
+    long rows;          /* Rows written to the current shard */
+    long bytes;         /* Bytes written to the current shard, its header included */
+} ShardState;
+
+static long maxrows = 0;
+static long maxbytes = 0;
+static char* partitiontable = NULL;
+static char* partitioncolumn = NULL;
+static int partitioncount = 0;
+static ShardState states[MAX_TABLES];
+
+void setshardlimits(long rows, long bytes) {
+    maxrows = rows;
+    maxbytes = bytes;
+}
+
+/* Partition the rows of a table by a column, given as table.column */
+int setpartition(const char* spec, int count) {
+    const char* dot = strrchr(spec, '.');
+    if (!dot || dot == spec || !dot[1] || count < 1) return 0;
+    free(partitiontable);
+    free(partitioncolumn);
+    partitiontable = strndup(spec, dot - spec);
+    partitioncolumn = strdup(dot + 1);
+    partitioncount = count;
+    return 1;
+}
+
+int sharding() {
+    return maxrows > 0 || maxbytes > 0 || partitiontable;
+}
+
+int partitions(Schema* schema, int owner) {
+    if (!partitiontable || owner < 0) return 0;
+    return strcmp(schema->tables[owner].name, partitiontable) == 0 ? partitioncount : 0;
+}
+
+int sharded(Schema* schema, int owner) {
+    return maxrows > 0 || maxbytes > 0 || partitions(schema, owner);
+}
+
+void shardpath(char* path, const char* output_dir, const char* name, int shard) {
+    sprintf(path, "%s/%s.%03d.csv", output_dir, name, shard);
+}
+
+/* Hash of a value as its CSV field reads, without the quotes of strings */
+static uint64_t hashcell(const Cell* cell) {
+    char buf[64];
+    const char* text = "";
+    switch (cell ? cell->type : CELL_NULL) {
+        case CELL_STR:
+            text = cell->value.strVal ? cell->value.strVal : "";
+            break;
+        case CELL_INT:
+            snprintf(buf, sizeof(buf), "%ld", cell->value.intVal);
+            text = buf;
+            break;
+        case CELL_NUM:
+            snprintf(buf, sizeof(buf), "%g", cell->value.numVal);
+            text = buf;
+            break;
+        case CELL_BOOL:
+            text = cell->value.boolVal ? "true" : "false";
+            break;
+        default:
+            break;
+    }
+    uint64_t h = 14695981039346656037ULL;
+    for (; *text; text++) {
+        h ^= (unsigned char)*text;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Shard a row of a partitioned table goes to, by the value of its partition column */
+int partitionshard(Schema* schema, int table, const Cell* cells, int count) {
+    int owner = gettablei(schema, schema->tables[table].name);
+    int shards = partitions(schema, owner);
+    if (!shards) return 0;
+    Table* t = &schema->tables[table];
+    for (int i = 0; i < t->column_count && i < count; i++) {
+        if (strcmp(t->columns[i].name, partitioncolumn) == 0) {
+            return (int)(hashcell(&cells[i]) % shards);
+        }
+    }
+    return (int)(hashcell(NULL) % shards);
+}
+
+/*
+ * Shard the next rows of a table with a row or byte limit go to. The limits
+ * are checked against what the writer reported with shardwrote(), so rows
+ * still buffered by stdio or the I/O thread are counted.
+ */
+int pickshard(int owner) {
+    if (owner < 0 || owner >= MAX_TABLES) return 0;
+    ShardState* state = &states[owner];
+    if (!shardheader(owner, state->current)) return state->current;
+    if ((maxrows > 0 && state->rows >= maxrows) || (maxbytes > 0 && state->bytes >= maxbytes)) {
+        state->current++;
+        state->rows = 0;
+        state->bytes = 0;
+    }
+    return state->current;
+}
+
+/* Count rows and bytes written to a shard of a table */
+void shardwrote(int owner, int shard, long rows, long bytes) {
+    if (owner < 0 || owner >= MAX_TABLES || shard != states[owner].current) return;
+    states[owner].rows += rows;
+    states[owner].bytes += bytes;
+}
+
+int shardsused(int owner) {
+    return owner >= 0 && owner < MAX_TABLES ? states[owner].used : 0;
+}
+
+int shardheader(int owner, int shard) {
+    if (owner < 0 || owner >= MAX_TABLES || shard >= states[owner].capacity) return 0;
+    return states[owner].header[shard];
+}
+
+/* Record that a shard exists with a header of the given columns */
+void setshardheader(int owner, int shard, int columns) {
+    if (owner < 0 || owner >= MAX_TABLES) return;
+    ShardState* state = &states[owner];
+    if (shard >= state->capacity) {
+        int capacity = state->capacity ? state->capacity : 16;
+        while (capacity <= shard) capacity *= 2;
+        int* header = realloc(state->header, capacity * sizeof(int));
+        if (!header) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+        memset(header + state->capacity, 0, (capacity - state->capacity) * sizeof(int));
+        state->header = header;
+        state->capacity = capacity;
+    }
+    state->header[shard] = columns;
+    if (shard >= state->used) state->used = shard + 1;
+}
+
+void freeshards() {
+    for (int i = 0; i < MAX_TABLES; i++) free(states[i].header);
+    memset(states, 0, sizeof(states));
+    free(partitiontable);
+    free(partitioncolumn);
+    partitiontable = partitioncolumn = NULL;
+}
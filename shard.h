@@ -0,0 +1,33 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "schema.h"
+#include "sink.h"
+
+/*
+ * Output sharding (--shard-rows, --shard-bytes, --partition-by). A sharded
+ * table is written to name.000.csv, name.001.csv, ... each with its own
+ * header. With a row or byte limit, the next shard is started when the
+ * file is opened and the rows and bytes the writer sent to the current one
+ * have reached the limit, so a shard holds whole records and may pass the
+ * limit by the rows of one record.
+ * The table named by --partition-by instead has a fixed number of shards
+ * and each row goes to the one picked by a hash of its column value.
+ * Shards are tracked by the first table with a name (gettablei).
+ */
+
+void setshardlimits(long rows, long bytes);
+int setpartition(const char* spec, int count);
+int sharding();
+int sharded(Schema* schema, int owner);
+int partitions(Schema* schema, int owner);
+int pickshard(int owner);
+void shardwrote(int owner, int shard, long rows, long bytes);
+int partitionshard(Schema* schema, int table, const Cell* cells, int count);
+void shardpath(char* path, const char* output_dir, const char* name, int shard);
+int shardsused(int owner);
+int shardheader(int owner, int shard);
+void setshardheader(int owner, int shard, int columns);
+void freeshards();
+
+#endif
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sink.h"
+#include "helper.h"
+#include "profile.h"
+
+static Sink current;
+static char begun[MAX_TABLES];
+
+/* Send rows to sink */
+void setsink(const Sink* sink) {
+    current = *sink;
+    memset(begun, 0, sizeof(begun));
+}
+
+static void begin(Schema* schema, int table) {
+    if (begun[table]) return;
+    begun[table] = 1;
+    if (current.begin_table) current.begin_table(current.context, schema, table);
+}
+
+/* Send a row to the sink, counting it for --stats and adding it to the --profile */
+void sinkrow(Schema* schema, int table, const Cell* cells, int count) {
+    if (table < 0 || table >= MAX_TABLES) return;
+    begin(schema, table);
+    if (current.row) current.row(current.context, schema, table, cells, count);
+    if (profiling()) {
+        for (int i = 0; i < count; i++) profilecell(table, i, &cells[i]);
+    }
+    schema->tables[table].rows_written++;
+}
+
+/* The rows of a record are all sent */
+void sinkrecord(Schema* schema) {
+    if (current.end_record) current.end_record(current.context, schema);
+}
+
+/* All rows are written: end every table */
+void sinkend(Schema* schema) {
+    for (int i = 0; i < schema->table_count; i++) {
+        begin(schema, i);
+        if (current.end_table) current.end_table(current.context, schema, i);
+    }
+}
+
+static void jsonlrow(void* context, Schema* schema, int table, const Cell* cells, int count) {
+    FILE* fp = context;
+    fputs("{\"table\": ", fp);
+    putjsonstr(fp, schema->tables[table].name);
+    fputs(", \"row\": [", fp);
+    for (int i = 0; i < count; i++) {
+        if (i) fputs(", ", fp);
+        switch (cells[i].type) {
+            case CELL_INT:
+                fprintf(fp, "%ld", cells[i].value.intVal);
+                break;
+            case CELL_NUM: {
+                /* Shortest form that reads back as the same double */
+                char buf[32];
+                snprintf(buf, sizeof(buf), "%.15g", cells[i].value.numVal);
+                if (strtod(buf, NULL) != cells[i].value.numVal) {
+                    snprintf(buf, sizeof(buf), "%.17g", cells[i].value.numVal);
+                }
+                fputs(buf, fp);
+                break;
+            }
+            case CELL_BOOL:
+                fputs(cells[i].value.boolVal ? "true" : "false", fp);
+                break;
+            case CELL_STR:
+                putjsonstr(fp, cells[i].value.strVal ? cells[i].value.strVal : "");
+                break;
+            default:
+                fputs("null", fp);
+                break;
+        }
+    }
+    fputs("]}\n", fp);
+}
+
+static void jsonlend(void* context, Schema* schema, int table) {
+    (void)schema;
+    (void)table;
+    fflush(context);
+}
+
+/* A sink writing each row as a JSON line to out (--sink=jsonl) */
+Sink jsonlsink(FILE* out) {
+    Sink sink = { NULL, jsonlrow, jsonlend, NULL, out };
+    return sink;
+}
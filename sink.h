@@ -0,0 +1,53 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdio.h>
+#include "schema.h"
+
+/*
+ * Row sinks. Every row is sent as typed cells to the Sink registered with
+ * setsink(): csvsink() (csv.h) writes the CSV files, jsonlsink() prints JSON
+ * lines, and a program linking the converter can register its own. For each
+ * table that gets rows, begin_table is called before its first row;
+ * end_record after the rows of each record (an element of a root array of
+ * objects, or the whole document); end_table for every table once all rows
+ * are written (after begin_table for tables without rows). A row has one cell
+ * for each column the table had when it was written; rows of the fixed posts
+ * and orders layouts have the fields of their own. Strings point into the
+ * AST and are valid only during the call. With --pipeline the calls come
+ * from the emitter thread. Callbacks may be NULL.
+ */
+
+typedef enum {
+    CELL_NULL,
+    CELL_INT,
+    CELL_NUM,
+    CELL_BOOL,
+    CELL_STR
+} CellType;
+
+typedef struct {
+    CellType type;
+    union {
+        long intVal;
+        double numVal;
+        int boolVal;
+        const char* strVal;
+    } value;
+} Cell;
+
+typedef struct {
+    void (*begin_table)(void* context, Schema* schema, int table);
+    void (*row)(void* context, Schema* schema, int table, const Cell* cells, int count);
+    void (*end_table)(void* context, Schema* schema, int table);
+    void (*end_record)(void* context, Schema* schema);
+    void* context;
+} Sink;
+
+void setsink(const Sink* sink);
+void sinkrow(Schema* schema, int table, const Cell* cells, int count);
+void sinkrecord(Schema* schema);
+void sinkend(Schema* schema);
+Sink jsonlsink(FILE* out);
+
+#endif
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "ast.h"
+#include "stats.h"
+#include "trace.h"
+#include "helper.h"
+
+static const char* phasenames[PHASE_COUNT] = { "parse", "schema", "csv" };
+
+static PhaseStats phases[PHASE_COUNT];
+static PhaseStats phasestart[PHASE_COUNT];
+
+static StageStats stages[MAX_STAGES];
+static int stagecount = 0;
+
+static long inputbytes = 0;
+static int counting = 0;    /* Allocations are counted only for --stats */
+static long alloccount = 0;
+static long allocbytes = 0;
+
+/*
+ * The converter's own objects are linked with --wrap for the allocator
+ * calls below (see LDFLAGS in the Makefile), so those calls come here and
+ * are forwarded to the real functions. Allocations made inside libc, such
+ * as stdio buffers, are not counted.
+ */
+extern void* __real_malloc(size_t size);
+extern void* __real_calloc(size_t n, size_t size);
+extern void* __real_realloc(void* ptr, size_t size);
+extern char* __real_strdup(const char* s);
+extern char* __real_strndup(const char* s, size_t n);
+
+static void countalloc(size_t size) {
+    __atomic_fetch_add(&alloccount, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&allocbytes, (long)size, __ATOMIC_RELAXED);
+}
+
+void* __wrap_malloc(size_t size) {
+    if (counting) countalloc(size);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+    if (counting) countalloc(n * size);
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    if (counting) countalloc(size);
+    return __real_realloc(ptr, size);
+}
+
+char* __wrap_strdup(const char* s) {
+    char* copy = __real_strdup(s);
+    if (counting && copy) countalloc(strlen(copy) + 1);
+    return copy;
+}
+
+char* __wrap_strndup(const char* s, size_t n) {
+    char* copy = __real_strndup(s, n);
+    if (counting && copy) countalloc(strlen(copy) + 1);
+    return copy;
+}
+
+/* Start counting allocations; called before any thread is started */
+void statscountallocs() {
+    counting = 1;
+}
+
+long statsallocs() {
+    return __atomic_load_n(&alloccount, __ATOMIC_RELAXED);
+}
+
+long statsallocbytes() {
+    return __atomic_load_n(&allocbytes, __ATOMIC_RELAXED);
+}
+
+void statsinput(long bytes) {
+    inputbytes += bytes;
+}
+
+/* Input bytes consumed by the scanner so far */
+long statsbytesin() {
+    return inputbytes;
+}
+
+void statsstage(const char* name, double busy, double wall) {
+    if (stagecount >= MAX_STAGES) return;
+    stages[stagecount].name = name;
+    stages[stagecount].busy = busy;
+    stages[stagecount].wall = wall;
+    stagecount++;
+}
+
+static double clocksec(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void snapshot(PhaseStats* s) {
+    s->wall = clocksec(CLOCK_MONOTONIC);
+    s->cpu = clocksec(CLOCK_PROCESS_CPUTIME_ID);
+    s->bytes_in = inputbytes;
+    s->nodes = getnodecount();
+    s->allocs = statsallocs();
+    s->alloc_bytes = statsallocbytes();
+}
+
+void statsbegin(Phase phase) {
+    snapshot(&phasestart[phase]);
+}
+
+void statsend(Phase phase) {
+    PhaseStats now;
+    snapshot(&now);
+    PhaseStats* s = &phases[phase];
+    PhaseStats* start = &phasestart[phase];
+    s->wall += now.wall - start->wall;
+    s->cpu += now.cpu - start->cpu;
+    s->bytes_in += now.bytes_in - start->bytes_in;
+    s->nodes += now.nodes - start->nodes;
+    s->allocs += now.allocs - start->allocs;
+    s->alloc_bytes += now.alloc_bytes - start->alloc_bytes;
+    s->ran = 1;
+    tracespan(phasenames[phase], "phase", start->wall, NULL, -1);
+}
+
+static long peakrss() {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+    return ru.ru_maxrss;
+}
+
+static void printtext(FILE* out, Schema* schema) {
+    fprintf(out, "===== Stats =====\n");
+    fprintf(out, "input bytes: %ld\n", inputbytes);
+    fprintf(out, "ast nodes:   %ld\n", getnodecount());
+    fprintf(out, "allocations: %ld (%ld bytes)\n", statsallocs(), statsallocbytes());
+    fprintf(out, "peak rss:    %ld KB\n", peakrss());
+    fprintf(out, "%-8s %10s %10s %12s %10s %10s %12s\n",
+            "phase", "wall s", "cpu s", "bytes in", "nodes", "allocs", "alloc bytes");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        PhaseStats* s = &phases[i];
+        if (!s->ran) continue;
+        fprintf(out, "%-8s %10.6f %10.6f %12ld %10ld %10ld %12ld\n",
+                phasenames[i], s->wall, s->cpu, s->bytes_in, s->nodes, s->allocs, s->alloc_bytes);
+    }
+    if (stagecount) fprintf(out, "%-8s %10s %10s %6s\n", "stage", "busy s", "wall s", "util");
+    for (int i = 0; i < stagecount; i++) {
+        StageStats* st = &stages[i];
+        fprintf(out, "%-8s %10.6f %10.6f %5.1f%%\n", st->name, st->busy, st->wall,
+                st->wall > 0 ? 100 * st->busy / st->wall : 0);
+    }
+    if (!schema) return;
+    fprintf(out, "%-20s %10s %12s %8s\n", "table", "rows", "bytes", "opens");
+    for (int i = 0; i < schema->table_count; i++) {
+        Table* table = &schema->tables[i];
+        fprintf(out, "%-20s %10ld %12ld %8d\n",
+                table->name, table->rows_written, table->bytes_written, table->file_opens);
+    }
+}
+
+static void printjson(FILE* out, Schema* schema) {
+    fprintf(out, "{\"input_bytes\": %ld, \"ast_nodes\": %ld, \"allocations\": %ld, "
+                 "\"alloc_bytes\": %ld, \"peak_rss_kb\": %ld,\n",
+            inputbytes, getnodecount(), statsallocs(), statsallocbytes(), peakrss());
+    fprintf(out, " \"phases\": [");
+    int first = 1;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        PhaseStats* s = &phases[i];
+        if (!s->ran) continue;
+        fprintf(out, "%s\n  {\"name\": \"%s\", \"wall_s\": %.6f, \"cpu_s\": %.6f, \"bytes_in\": %ld, "
+                     "\"nodes\": %ld, \"allocs\": %ld, \"alloc_bytes\": %ld}",
+                first ? "" : ",", phasenames[i], s->wall, s->cpu, s->bytes_in,
+                s->nodes, s->allocs, s->alloc_bytes);
+        first = 0;
+    }
+    if (stagecount) {
+        fprintf(out, "],\n \"stages\": [");
+        for (int i = 0; i < stagecount; i++) {
+            StageStats* st = &stages[i];
+            fprintf(out, "%s\n  {\"name\": \"%s\", \"busy_s\": %.6f, \"wall_s\": %.6f, \"utilization\": %.4f}",
+                    i ? "," : "", st->name, st->busy, st->wall, st->wall > 0 ? st->busy / st->wall : 0);
+        }
+    }
+    fprintf(out, "],\n \"tables\": [");
+    for (int i = 0; schema && i < schema->table_count; i++) {
+        Table* table = &schema->tables[i];
+        fprintf(out, "%s\n  {\"name\": ", i ? "," : "");
+        putjsonstr(out, table->name);
+        fprintf(out, ", \"rows\": %ld, \"bytes\": %ld, \"opens\": %d}",
+                table->rows_written, table->bytes_written, table->file_opens);
+    }
+    fprintf(out, "]}\n");
+}
+
+void printstats(FILE* out, StatsFormat format, Schema* schema) {
+    switch (format) {
+        case STATS_TEXT:
+            printtext(out, schema);
+            break;
+        case STATS_JSON:
+            printjson(out, schema);
+            break;
+        default:
+            break;
+    }
+}
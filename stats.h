@@ -0,0 +1,52 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include "schema.h"
+
+/* Pipeline phases timed by --stats */
+typedef enum {
+    PHASE_PARSE,    /* yyparse: scanning and AST construction */
+    PHASE_SCHEMA,   /* genSchema: table and column inference */
+    PHASE_CSV,      /* makecsv: row emission */
+    PHASE_COUNT
+} Phase;
+
+/* Report formats */
+typedef enum {
+    STATS_OFF,
+    STATS_TEXT,
+    STATS_JSON
+} StatsFormat;
+
+/* Counters for one phase, taken as deltas between statsbegin and statsend */
+typedef struct {
+    double wall;        /* Wall clock seconds */
+    double cpu;         /* Process CPU seconds */
+    long bytes_in;      /* Input bytes consumed by the scanner */
+    long nodes;         /* AST nodes created */
+    long allocs;        /* malloc/calloc/realloc/strdup calls by the converter */
+    long alloc_bytes;   /* Bytes requested from the allocator */
+    int ran;            /* True once the phase has completed */
+} PhaseStats;
+
+/* Busy time of one --pipeline stage thread */
+typedef struct {
+    const char* name;
+    double busy;        /* Seconds spent working rather than waiting on a ring */
+    double wall;        /* Seconds the thread ran */
+} StageStats;
+
+#define MAX_STAGES 4
+
+void statsbegin(Phase phase);
+void statsend(Phase phase);
+void statsinput(long bytes);
+long statsbytesin();
+void statsstage(const char* name, double busy, double wall);
+void statscountallocs();
+long statsallocs();
+long statsallocbytes();
+void printstats(FILE* out, StatsFormat format, Schema* schema);
+
+#endif
@@ -0,0 +1,263 @@
+#!/bin/sh
+#
+# Golden-output tests. Runs the converter over the inputs in tests/ in each
+# mode and compares its stdout, the errors it reports, its exit status and
+# every file it writes with tests/golden/NAME.out.
+#
+#   tests/run.sh BIN [--update]
+#
+# --update rewrites the golden files from BIN instead of comparing.
+
+BIN=$1
+UPDATE=$2
+if [ ! -x "$BIN" ]; then
+    echo "Usage: $0 BIN [--update]" >&2
+    exit 2
+fi
+case $BIN in
+    /*) ;;
+    *) BIN=$(pwd)/$BIN ;;
+esac
+TESTS=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+passed=0
+failed=0
+
+# Begin case NAME; the converter writes to $OUT
+start() {
+    NAME=$1
+    OUT=$WORK/$NAME
+    mkdir -p "$OUT"
+    : > "$WORK/$NAME.log"
+}
+
+# Log the Error: lines of the last run and its exit status
+logexit() {
+    status=$1
+    grep '^Error:' "$WORK/stderr" >> "$WORK/$NAME.log"
+    echo "exit $status" >> "$WORK/$NAME.log"
+}
+
+# Convert tests/INPUT with the given options, logging stdout, errors and the exit status
+run() {
+    input=$1
+    shift
+    "$BIN" "$@" --out-dir "$OUT" < "$TESTS/$input" >> "$WORK/$NAME.log" 2> "$WORK/stderr"
+    logexit $?
+}
+
+# Like run, on the first BYTES bytes of tests/INPUT
+runcut() {
+    bytes=$1
+    input=$2
+    shift 2
+    head -c "$bytes" "$TESTS/$input" | "$BIN" "$@" --out-dir "$OUT" >> "$WORK/$NAME.log" 2> "$WORK/stderr"
+    logexit $?
+}
+
+# Compare the case with its golden file
+finish() {
+    {
+        echo "== stdout"
+        cat "$WORK/$NAME.log"
+        (cd "$OUT" && find . -type f | sort) | while read -r f; do
+            echo "== ${f#./}"
+            cat "$OUT/$f"
+        done
+    } > "$WORK/$NAME.out"
+    if [ "$UPDATE" = "--update" ]; then
+        cp "$WORK/$NAME.out" "$TESTS/golden/$NAME.out"
+        passed=$((passed + 1))
+    elif diff -u "$TESTS/golden/$NAME.out" "$WORK/$NAME.out" > "$WORK/$NAME.diff" 2>&1; then
+        passed=$((passed + 1))
+    else
+        echo "FAIL $NAME"
+        head -40 "$WORK/$NAME.diff"
+        failed=$((failed + 1))
+    fi
+}
+
+mkdir -p "$TESTS/golden"
+cd "$WORK" || exit 2
+
+# Default path over every sample document
+for f in "$TESTS"/test*.json "$TESTS"/error.json; do
+    name=$(basename "$f" .json)
+    start "default-$name"
+    run "$name.json"
+    finish
+done
+
+start records
+run records.json
+finish
+
+start single-pass
+run records.json --single-pass
+finish
+
+start tape
+run records.json --tape
+finish
+
+start select
+run records.json --select '$[*].customer' --select '$[*].tags'
+finish
+
+start where
+run records.json --where 'status == "paid" && total > 100'
+finish
+
+start natural-key
+run records.json --natural-key ayeshas.cid
+finish
+
+# Conditions on nested keys; a malformed rule stops the run before any output
+start naming-rules
+printf 'element customer.cid:s -> sales\nkey=customer cid name:s -> buyers\n' > rules
+run records.json --naming-rules rules
+printf 'element customer. -> sales\n' > bad.rules
+run records.json --naming-rules bad.rules
+finish
+
+start pipeline
+run records.json --pipeline
+finish
+
+start async-io
+run records.json --async-io
+finish
+
+# A run cut short after two checkpointed records, then resumed
+start resume
+runcut 420 records.json --pipeline --checkpoint 1
+run records.json --pipeline --resume
+finish
+
+start append
+run records.json --append
+run records.json --append
+finish
+
+# A --pipeline run appending to the files of a run without it
+start append-mixed
+run records.json --append
+run records.json --pipeline --append
+finish
+
+# Appending to files written without --append, which left no saved state
+start append-scan
+run records.json
+run records.json --pipeline --append
+finish
+
+start schema-manifest
+run records.json --schema-out "$OUT/schema.manifest"
+finish
+
+start recovery
+run bad_records.json --max-errors 2 --quarantine "$OUT/quarantine.jsonl"
+finish
+
+start recovery-limit
+run bad_records.json --max-errors 1
+finish
+
+start missing-comma
+run missing_comma.json --max-errors 1 --quarantine "$OUT/quarantine.jsonl"
+run missing_comma.json --pipeline --max-errors 1
+finish
+
+start bad-root
+run bad_root.json --max-errors 1
+finish
+
+start utf8-replace
+run escapes.json
+finish
+
+start utf8-reject
+run escapes.json --utf8=reject
+finish
+
+start profile
+run records.json --profile "$OUT/profile.json"
+finish
+
+start shard-rows
+run records.json --shard-rows 2
+finish
+
+# Shard sizes counted from the rows sent, not from files the I/O thread may not have written yet
+start shard-bytes-async
+run records.json --async-io --shard-bytes 150
+finish
+
+start partition
+run records.json --partition-by root.city --partitions 3
+finish
+
+start dedup
+run records.json --dedup-subtrees
+finish
+
+# Subtrees written before a checkpoint or an earlier --append run are not written again
+start dedup-resume
+runcut 420 records.json --pipeline --checkpoint 1 --dedup-subtrees
+run records.json --pipeline --resume --dedup-subtrees
+finish
+
+start dedup-append
+run records.json --append --dedup-subtrees
+run records.json --append --dedup-subtrees
+finish
+
+start sink-jsonl
+run records.json --sink=jsonl
+finish
+
+# The fixed orders and posts layouts carry the same rows as their CSV files
+start sink-fixed
+run test1.json --sink=jsonl
+run test4.json --sink=jsonl
+run test6.json --sink=jsonl
+finish
+
+start input-gzip
+gzip -c "$TESTS/records.json" > "$WORK/records.json.gz"
+run records.json --input "$WORK/records.json.gz"
+finish
+
+# records.json padded to N MiB, so the stream ends exactly at a slot boundary
+padded() {
+    size=$(wc -c < "$TESTS/records.json")
+    cat "$TESTS/records.json"
+    head -c $(($1 * 1048576 - size)) /dev/zero | tr '\0' ' '
+}
+
+start input-gzip-slots
+for n in 1 2; do
+    padded $n | gzip -c > "$WORK/padded$n.json.gz"
+    run records.json --input "$WORK/padded$n.json.gz"
+done
+finish
+
+# Only when zstd is installed and the converter was built with ZSTD=1
+printf '[]' > "$WORK/probe.json"
+if command -v zstd > /dev/null && zstd -q "$WORK/probe.json" -o "$WORK/probe.json.zst" &&
+        "$BIN" --input "$WORK/probe.json.zst" --out-dir "$WORK" > /dev/null 2>&1; then
+    start input-zstd-slots
+    for n in 1 2; do
+        padded $n | zstd -q -c > "$WORK/padded$n.json.zst"
+        run records.json --input "$WORK/padded$n.json.zst"
+    done
+    finish
+fi
+
+if [ "$UPDATE" = "--update" ]; then
+    echo "updated $passed golden files"
+    exit 0
+fi
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]
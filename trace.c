@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "trace.h"
+#include "helper.h"
+
+#define SLOW_SPAN 0.001     /* Seconds from which a sampled span is always kept */
+
+static FILE* out = NULL;
+static int enabled = 0;
+static int every = 1;
+static double base = 0;
+static long seen = 0;
+static int events = 0;
+static int nexttid = 0;
+static __thread int tid = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+double tracetime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int tracing() {
+    return enabled;
+}
+
+static int threadid() {
+    if (!tid) tid = __atomic_add_fetch(&nexttid, 1, __ATOMIC_RELAXED);
+    return tid;
+}
+
+/* Start an event, unless the trace was stopped meanwhile; the caller holds the lock */
+static int beginevent() {
+    if (!out) return 0;
+    fputs(events++ ? ",\n" : "[\n", out);
+    return 1;
+}
+
+/*
+ * Record the trace to path, keeping one in every sample frequent spans.
+ * The file is a JSON array of events, closed at exit.
+ */
+int starttrace(const char* path, int sample) {
+    out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Could not open trace file %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    every = sample > 0 ? sample : 1;
+    base = tracetime();
+    enabled = 1;
+    atexit(stoptrace);
+    tracethread("main");
+    return 1;
+}
+
+/* Name the calling thread in the trace */
+void tracethread(const char* name) {
+    if (!enabled) return;
+    int id = threadid();
+    pthread_mutex_lock(&lock);
+    if (!beginevent()) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    fprintf(out, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ", id);
+    putjsonstr(out, name);
+    fputs("}}", out);
+    pthread_mutex_unlock(&lock);
+}
+
+/* Record a span from start to now; table and index are added as args when set (not NULL, >= 0) */
+void tracespan(const char* name, const char* cat, double start, const char* table, long index) {
+    if (!enabled) return;
+    double end = tracetime();
+    int id = threadid();
+    pthread_mutex_lock(&lock);
+    if (!beginevent()) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    fprintf(out, "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d",
+            name, cat, (start - base) * 1e6, (end - start) * 1e6, id);
+    if (table || index >= 0) {
+        fputs(", \"args\": {", out);
+        if (table) {
+            fputs("\"table\": ", out);
+            putjsonstr(out, table);
+        }
+        if (index >= 0) fprintf(out, "%s\"index\": %ld", table ? ", " : "", index);
+        fputc('}', out);
+    }
+    fputc('}', out);
+    pthread_mutex_unlock(&lock);
+}
+
+/* Record a frequent span if it is sampled or slow */
+void tracesampled(const char* name, const char* cat, double start, const char* table, long index) {
+    if (!enabled) return;
+    long n = __atomic_add_fetch(&seen, 1, __ATOMIC_RELAXED);
+    if (n % every != 0 && tracetime() - start < SLOW_SPAN) return;
+    tracespan(name, cat, start, table, index);
+}
+
+void stoptrace() {
+    if (!out) return;
+    pthread_mutex_lock(&lock);
+    enabled = 0;
+    fputs(events ? "\n]\n" : "[]\n", out);
+    fclose(out);
+    out = NULL;
+    pthread_mutex_unlock(&lock);
+}
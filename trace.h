@@ -0,0 +1,21 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Timeline of a run in Chrome trace-event format (--trace-file), for
+ * chrome://tracing or Perfetto. Phases and thread lifetimes are always
+ * recorded; frequent spans (records, file opens and flushes, I/O writes,
+ * strings) go through tracesampled(), which keeps one call in every
+ * --trace-sample and every span of a millisecond or more. Times come from
+ * tracetime(), in seconds; a caller keeps a start of 0 when not tracing.
+ */
+
+int starttrace(const char* path, int sample);
+int tracing();
+double tracetime();
+void tracethread(const char* name);
+void tracespan(const char* name, const char* cat, double start, const char* table, long index);
+void tracesampled(const char* name, const char* cat, double start, const char* table, long index);
+void stoptrace();
+
+#endif
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "unescape.h"
+
+static Utf8Policy policy = UTF8_REPLACE;
+
+void set_utf8_policy(Utf8Policy p) {
+    policy = p;
+}
+
+/* Byte after the backslash of a one character escape, 0 if it is not one */
+static const char escapes[256] = {
+    ['"'] = '"', ['\\'] = '\\', ['/'] = '/', ['b'] = '\b',
+    ['f'] = '\f', ['n'] = '\n', ['r'] = '\r', ['t'] = '\t'
+};
+
+/* Value of a hex digit plus one, 0 if it is not one */
+static const unsigned char hexdigits[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+
+/* Length of the UTF-8 sequence a byte starts, 0 if it cannot start one */
+static const unsigned char utf8len[256] = {
+    [0x00 ... 0x7F] = 1,
+    [0xC2 ... 0xDF] = 2,
+    [0xE0 ... 0xEF] = 3,
+    [0xF0 ... 0xF4] = 4
+};
+
+/* Narrower range of the second byte after some lead bytes, 0 for 0x80-0xBF */
+static const unsigned char utf8low[256] = { [0xE0] = 0xA0, [0xF0] = 0x90 };
+static const unsigned char utf8high[256] = { [0xED] = 0x9F, [0xF4] = 0x8F };
+
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+/* Eight bytes that are all ASCII and none a backslash */
+static inline int plainword(uint64_t w) {
+    uint64_t slashes = w ^ (ONES * '\\');
+    return !(((slashes - ONES) & ~slashes & HIGHS) | (w & HIGHS));
+}
+
+static long hex4(const unsigned char* s) {
+    long value = 0;
+    for (int k = 0; k < 4; k++) {
+        int d = hexdigits[s[k]];
+        if (!d) return -1;
+        value = value << 4 | (d - 1);
+    }
+    return value;
+}
+
+static int encode(long u, char* out) {
+    if (u < 0x80) {
+        out[0] = (char)u;
+        return 1;
+    }
+    if (u < 0x800) {
+        out[0] = (char)(0xC0 | (u >> 6));
+        out[1] = (char)(0x80 | (u & 0x3F));
+        return 2;
+    }
+    if (u < 0x10000) {
+        out[0] = (char)(0xE0 | (u >> 12));
+        out[1] = (char)(0x80 | ((u >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (u & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (u >> 18));
+    out[1] = (char)(0x80 | ((u >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((u >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (u & 0x3F));
+    return 4;
+}
+
+/*
+ * Decode the escape at s into out; returns the bytes written, or -1 when it
+ * is invalid. *taken is set to the input bytes it covers either way.
+ */
+static int escape(const unsigned char* s, size_t n, char* out, int* taken) {
+    *taken = n < 2 ? (int)n : 2;
+    if (n < 2) return -1;
+    if (escapes[s[1]]) {
+        *out = escapes[s[1]];
+        return 1;
+    }
+    long u = s[1] == 'u' && n >= 6 ? hex4(s + 2) : -1;
+    if (u < 0) return -1;
+    *taken = 6;
+    if (u >= 0xD800 && u <= 0xDBFF) {
+        long low = n >= 12 && s[6] == '\\' && s[7] == 'u' ? hex4(s + 8) : -1;
+        if (low < 0xDC00 || low > 0xDFFF) return -1;
+        u = 0x10000 + ((u - 0xD800) << 10) + (low - 0xDC00);
+        *taken = 12;
+    } else if ((u >= 0xDC00 && u <= 0xDFFF) || u == 0) {
+        /* A lone low surrogate, or a NUL that would end the string */
+        return -1;
+    }
+    return encode(u, out);
+}
+
+/* Length of the valid UTF-8 sequence at s, 0 if there is none */
+static int utf8seq(const unsigned char* s, size_t n) {
+    int k = utf8len[s[0]];
+    if (!k || (size_t)k > n) return 0;
+    if (k == 1) return 1;
+    unsigned char low = utf8low[s[0]] ? utf8low[s[0]] : 0x80;
+    unsigned char high = utf8high[s[0]] ? utf8high[s[0]] : 0xBF;
+    if (s[1] < low || s[1] > high) return 0;
+    for (int m = 2; m < k; m++) {
+        if ((s[m] & 0xC0) != 0x80) return 0;
+    }
+    return k;
+}
+
+/*
+ * Decode the len bytes between the quotes of a JSON string. Returns a new
+ * string, or NULL with *error set when the policy rejects invalid input.
+ */
+char* unescape(const char* text, size_t len, const char** error) {
+    const unsigned char* s = (const unsigned char*)text;
+    size_t cap = len + 1;
+    char* out = malloc(cap);
+    if (!out) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    *error = NULL;
+
+    size_t i = 0, j = 0;
+    while (i < len) {
+        /* Runs of plain ASCII are copied a word at a time */
+        while (i + 8 <= len) {
+            uint64_t w;
+            memcpy(&w, s + i, 8);
+            if (!plainword(w)) break;
+            memcpy(out + j, &w, 8);
+            i += 8;
+            j += 8;
+        }
+        if (i >= len) break;
+
+        int taken, written;
+        if (s[i] == '\\') {
+            written = escape(s + i, len - i, out + j, &taken);
+        } else {
+            taken = utf8seq(s + i, len - i);
+            written = taken;
+            if (taken) {
+                memcpy(out + j, s + i, taken);
+            } else {
+                taken = 1;
+                written = -1;
+            }
+        }
+        if (written < 0) {
+            if (policy == UTF8_REJECT) {
+                *error = s[i] == '\\' ? "Invalid escape in string" : "Invalid UTF-8 in string";
+                free(out);
+                return NULL;
+            }
+            if (policy == UTF8_PASS) {
+                memcpy(out + j, s + i, taken);
+                written = taken;
+            } else {
+                /* U+FFFD may be longer than what it replaces */
+                size_t need = j + 3 + (len - i - taken) + 1;
+                if (need > cap) {
+                    cap = need > 2 * cap ? need : 2 * cap;
+                    out = realloc(out, cap);
+                    if (!out) {
+                        fprintf(stderr, "Memory allocation failed\n");
+                        exit(1);
+                    }
+                }
+                written = encode(0xFFFD, out + j);
+            }
+        }
+        i += taken;
+        j += written;
+    }
+    out[j] = '\0';
+    return out;
+}
@@ -0,0 +1,23 @@
+#ifndef UNESCAPE_H
+#define UNESCAPE_H
+
+#include <stddef.h>
+
+/*
+ * Decoding of JSON string contents. Escapes are decoded and raw bytes are
+ * checked to be UTF-8 in one pass; \u escapes of a surrogate pair become
+ * one 4-byte sequence. What happens to input that is not valid (a bad
+ * escape, a lone surrogate, \u0000 or bytes that are not UTF-8) is set
+ * with --utf8.
+ */
+
+typedef enum {
+    UTF8_REPLACE,   /* Write U+FFFD in place of the invalid input */
+    UTF8_REJECT,    /* Fail the string */
+    UTF8_PASS       /* Copy the invalid input unchanged */
+} Utf8Policy;
+
+void set_utf8_policy(Utf8Policy policy);
+char* unescape(const char* text, size_t len, const char** error);
+
+#endif
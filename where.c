@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "where.h"
+
+typedef enum {
+    VAL_MISSING,
+    VAL_NULL,
+    VAL_BOOL,
+    VAL_NUM,
+    VAL_STR
+} ValueKind;
+
+typedef struct {
+    ValueKind kind;
+    double num;         /* VAL_NUM and VAL_BOOL */
+    const char* str;    /* VAL_STR */
+} Value;
+
+typedef enum {
+    OP_FIELD,       /* Push a field of the record */
+    OP_CONST,       /* Push a literal */
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_AND,
+    OP_OR,
+    OP_NOT,
+    OP_TRUTH        /* Turn a lone operand into a condition */
+} OpCode;
+
+typedef struct {
+    OpCode op;
+    char** path;        /* OP_FIELD: keys from the record down */
+    int depth;          /* OP_FIELD: number of keys */
+    Value value;        /* OP_CONST */
+} Instr;
+
+static Instr* program = NULL;
+static int length = 0;
+static int capacity = 0;
+static int maxstack = 0;    /* Deepest evaluation stack the program needs */
+static const char* src;     /* Expression being compiled */
+
+static Instr* emit(OpCode op) {
+    if (length == capacity) {
+        capacity = capacity ? capacity * 2 : 16;
+        program = realloc(program, capacity * sizeof(Instr));
+        switch (program != NULL) {
+            case 0:
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+        }
+    }
+    Instr* instr = &program[length++];
+    memset(instr, 0, sizeof(*instr));
+    instr->op = op;
+    return instr;
+}
+
+static void skipspace() {
+    while (isspace((unsigned char)*src)) src++;
+}
+
+static int accept(const char* token) {
+    skipspace();
+    size_t len = strlen(token);
+    if (strncmp(src, token, len) != 0) return 0;
+    src += len;
+    return 1;
+}
+
+static int isword(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+static int parseor();
+
+static int parseoperand() {
+    skipspace();
+    if (*src == '"') {
+        size_t cap = 16;
+        size_t n = 0;
+        char* str = malloc(cap);
+        if (!str) return 0;
+        src++;
+        while (*src && *src != '"') {
+            if (*src == '\\' && src[1]) src++;
+            if (n + 2 > cap) {
+                cap *= 2;
+                char* grown = realloc(str, cap);
+                if (!grown) {
+                    free(str);
+                    return 0;
+                }
+                str = grown;
+            }
+            str[n++] = *src++;
+        }
+        str[n] = '\0';
+        if (*src != '"') {
+            free(str);
+            return 0;
+        }
+        src++;
+        Instr* instr = emit(OP_CONST);
+        instr->value.kind = VAL_STR;
+        instr->value.str = str;
+        return 1;
+    }
+    if (*src == '-' || isdigit((unsigned char)*src)) {
+        char* end;
+        double num = strtod(src, &end);
+        if (end == src) return 0;
+        src = end;
+        Instr* instr = emit(OP_CONST);
+        instr->value.kind = VAL_NUM;
+        instr->value.num = num;
+        return 1;
+    }
+    const char* start = src;
+    while (isword(*src)) src++;
+    size_t len = src - start;
+    if (len == 0) return 0;
+    if (len == 4 && strncmp(start, "true", 4) == 0) {
+        Instr* instr = emit(OP_CONST);
+        instr->value.kind = VAL_BOOL;
+        instr->value.num = 1;
+    } else if (len == 5 && strncmp(start, "false", 5) == 0) {
+        Instr* instr = emit(OP_CONST);
+        instr->value.kind = VAL_BOOL;
+    } else if (len == 4 && strncmp(start, "null", 4) == 0) {
+        emit(OP_CONST)->value.kind = VAL_NULL;
+    } else {
+        /* Field path: split on dots, an optional leading $. refers to the record */
+        if (len > 2 && strncmp(start, "$.", 2) == 0) {
+            start += 2;
+            len -= 2;
+        }
+        Instr* instr = emit(OP_FIELD);
+        const char* p = start;
+        while (p < start + len) {
+            const char* dot = memchr(p, '.', start + len - p);
+            size_t seglen = dot ? (size_t)(dot - p) : (size_t)(start + len - p);
+            if (seglen == 0) return 0;
+            char** path = realloc(instr->path, (instr->depth + 1) * sizeof(char*));
+            if (!path) return 0;
+            instr->path = path;
+            instr->path[instr->depth++] = strndup(p, seglen);
+            p += seglen + (dot ? 1 : 0);
+        }
+    }
+    return 1;
+}
+
+static int parseunary() {
+    skipspace();
+    if (*src == '!' && src[1] != '=') {
+        src++;
+        if (!parseunary()) return 0;
+        emit(OP_NOT);
+        return 1;
+    }
+    if (accept("(")) {
+        if (!parseor() || !accept(")")) return 0;
+        return 1;
+    }
+    if (!parseoperand()) return 0;
+    /* Longer operators first so that <= is not read as < */
+    static const char* ops[] = { "==", "!=", "<=", ">=", "<", ">" };
+    static const OpCode codes[] = { OP_EQ, OP_NE, OP_LE, OP_GE, OP_LT, OP_GT };
+    for (int i = 0; i < 6; i++) {
+        if (accept(ops[i])) {
+            if (!parseoperand()) return 0;
+            emit(codes[i]);
+            return 1;
+        }
+    }
+    emit(OP_TRUTH);
+    return 1;
+}
+
+static int parseand() {
+    if (!parseunary()) return 0;
+    while (accept("&&")) {
+        if (!parseunary()) return 0;
+        emit(OP_AND);
+    }
+    return 1;
+}
+
+static int parseor() {
+    if (!parseand()) return 0;
+    while (accept("||")) {
+        if (!parseand()) return 0;
+        emit(OP_OR);
+    }
+    return 1;
+}
+
+/* Compile expr; returns 0 on a syntax error */
+int compilewhere(const char* expr) {
+    freewhere();
+    src = expr;
+    if (!parseor()) {
+        freewhere();
+        return 0;
+    }
+    skipspace();
+    if (*src) {
+        freewhere();
+        return 0;
+    }
+    /* Every operand pushes one value and every operator pops at most one net */
+    maxstack = length;
+    return 1;
+}
+
+int filtering() {
+    return length > 0;
+}
+
+static Value fieldvalue(ASTNode* record, Instr* instr) {
+    Value value = { VAL_MISSING, 0, NULL };
+    ASTNode* node = record;
+    for (int i = 0; i < instr->depth && node; i++) {
+        node = getbyname(node, instr->path[i]);
+    }
+    if (!node) return value;
+    switch (nodetype(node)) {
+        case nodestr:
+            value.kind = VAL_STR;
+            value.str = getstr(node);
+            break;
+        case nodeint:
+            value.kind = VAL_NUM;
+            value.num = getint(node);
+            break;
+        case nodenum:
+            value.kind = VAL_NUM;
+            value.num = getnum(node);
+            break;
+        case nodebool:
+            value.kind = VAL_BOOL;
+            value.num = getbool(node);
+            break;
+        case nodenull:
+            value.kind = VAL_NULL;
+            break;
+        default:
+            break;
+    }
+    return value;
+}
+
+static int compare(Value a, Value b, OpCode op) {
+    if (a.kind == VAL_MISSING) a.kind = VAL_NULL;
+    if (b.kind == VAL_MISSING) b.kind = VAL_NULL;
+    if (a.kind != b.kind) return op == OP_NE;
+    int cmp = 0;
+    switch (a.kind) {
+        case VAL_NUM:
+        case VAL_BOOL:
+            cmp = (a.num > b.num) - (a.num < b.num);
+            break;
+        case VAL_STR:
+            cmp = strcmp(a.str, b.str);
+            break;
+        default:
+            break;
+    }
+    switch (op) {
+        case OP_EQ: return cmp == 0;
+        case OP_NE: return cmp != 0;
+        case OP_LT: return cmp < 0;
+        case OP_LE: return cmp <= 0;
+        case OP_GT: return cmp > 0;
+        case OP_GE: return cmp >= 0;
+        default: return 0;
+    }
+}
+
+static int truth(Value v) {
+    switch (v.kind) {
+        case VAL_BOOL:
+        case VAL_NUM:
+            return v.num != 0;
+        case VAL_STR:
+            return v.str[0] != '\0';
+        default:
+            return 0;
+    }
+}
+
+/* Run the program against a record; returns 1 when the record is kept */
+int wherematch(ASTNode* record) {
+    if (!length) return 1;
+    Value stackbuf[32];
+    Value* stack = maxstack <= 32 ? stackbuf : malloc(maxstack * sizeof(Value));
+    if (!stack) return 1;
+    int top = 0;
+    for (int i = 0; i < length; i++) {
+        Instr* instr = &program[i];
+        Value result = { VAL_BOOL, 0, NULL };
+        switch (instr->op) {
+            case OP_FIELD:
+                stack[top++] = fieldvalue(record, instr);
+                continue;
+            case OP_CONST:
+                stack[top++] = instr->value;
+                continue;
+            case OP_NOT:
+                result.num = !truth(stack[top - 1]);
+                top--;
+                break;
+            case OP_TRUTH:
+                result.num = truth(stack[top - 1]);
+                top--;
+                break;
+            case OP_AND:
+                result.num = truth(stack[top - 2]) && truth(stack[top - 1]);
+                top -= 2;
+                break;
+            case OP_OR:
+                result.num = truth(stack[top - 2]) || truth(stack[top - 1]);
+                top -= 2;
+                break;
+            default:
+                result.num = compare(stack[top - 2], stack[top - 1], instr->op);
+                top -= 2;
+                break;
+        }
+        stack[top++] = result;
+    }
+    int keep = top > 0 && truth(stack[top - 1]);
+    if (stack != stackbuf) free(stack);
+    return keep;
+}
+
+void freewhere() {
+    for (int i = 0; i < length; i++) {
+        Instr* instr = &program[i];
+        for (int j = 0; j < instr->depth; j++) free(instr->path[j]);
+        free(instr->path);
+        if (instr->op == OP_CONST && instr->value.kind == VAL_STR) free((char*)instr->value.str);
+    }
+    free(program);
+    program = NULL;
+    length = 0;
+    capacity = 0;
+    maxstack = 0;
+}
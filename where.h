@@ -0,0 +1,26 @@
+#ifndef WHERE_H
+#define WHERE_H
+
+#include "ast.h"
+
+/*
+ * Record filter (--where). The expression is compiled once into a postfix
+ * program and run against every root record, or every element of a root
+ * array, as soon as the parser completes it. Grammar:
+ *
+ *   expr    := and ('||' and)*
+ *   and     := unary ('&&' unary)*
+ *   unary   := '!' unary | '(' expr ')' | operand [cmp operand]
+ *   cmp     := '==' | '!=' | '<' | '<=' | '>' | '>='
+ *   operand := field.path | number | "string" | true | false | null
+ *
+ * A lone operand is true when it is true, a non-zero number or a non-empty
+ * string. Missing fields compare like null.
+ */
+
+int compilewhere(const char* expr);
+int filtering();
+int wherematch(ASTNode* record);
+void freewhere();
+
+#endif
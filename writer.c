@@ -0,0 +1,411 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "writer.h"
+#include "trace.h"
+
+#define IO_BLOCK 65536
+#define ENTER_RETRIES 16   /* Failed io_uring_enter calls before the ring is given up */
+
+/* A filled block for fd, or a close of fd when data is NULL */
+typedef struct {
+    int fd;
+    char* data;
+    size_t len;
+} WriteJob;
+
+/* Writes of consecutive blocks of one file */
+typedef struct {
+    int fd;
+    struct iovec* iov;
+    int iovcnt;
+    size_t len;
+} WriteRun;
+
+/* Stream state behind an asyncopen() FILE */
+typedef struct {
+    int fd;
+    char* block;
+    size_t used;
+} AsyncFile;
+
+typedef struct {
+    int fd;
+    unsigned* sqtail;
+    unsigned* sqmask;
+    unsigned* sqarray;
+    unsigned* cqhead;
+    unsigned* cqtail;
+    unsigned* cqmask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    unsigned entries;
+    void* sqring;
+    size_t sqsize;
+    void* cqring;
+    size_t cqsize;
+} Ring;
+
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t notfull = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t notempty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+static WriteJob* queue = NULL;
+static int depth = 0;
+static int head = 0;
+static int queued = 0;
+static int busy = 0;        /* Jobs taken by the I/O thread and not done yet */
+static int running = 0;
+static int stopping = 0;
+static int failed = 0;
+static Ring ring;
+static int ringopen = 0;     /* ring is set up, whether or not it is still used */
+static int useuring = 0;
+
+static void writefailed(int err) {
+    if (!failed) fprintf(stderr, "Error: Could not write CSV output: %s\n", strerror(err));
+    failed = 1;
+}
+
+/* Write iov to fd, starting skip bytes in */
+static void writeall(int fd, struct iovec* iov, int iovcnt, size_t skip) {
+    while (iovcnt > 0) {
+        while (iovcnt > 0 && skip >= iov->iov_len) {
+            skip -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt == 0) return;
+        struct iovec first = *iov;
+        iov->iov_base = (char*)iov->iov_base + skip;
+        iov->iov_len -= skip;
+        ssize_t n = writev(fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+        *iov = first;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            writefailed(errno);
+            return;
+        }
+        skip += n;
+    }
+}
+
+static int ringsetup(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) return 0;
+    ring.fd = fd;
+    ring.sqsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring.cqsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring.cqsize > ring.sqsize) ring.sqsize = ring.cqsize;
+        ring.cqsize = ring.sqsize;
+    }
+    ring.sqring = mmap(NULL, ring.sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_SQ_RING);
+    ring.cqring = ring.sqring;
+    if (ring.sqring != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring.cqring = mmap(NULL, ring.cqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           fd, IORING_OFF_CQ_RING);
+    }
+    ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring.sqring == MAP_FAILED || ring.cqring == MAP_FAILED || ring.sqes == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+    char* sq = ring.sqring;
+    char* cq = ring.cqring;
+    ring.sqtail = (unsigned*)(sq + p.sq_off.tail);
+    ring.sqmask = (unsigned*)(sq + p.sq_off.ring_mask);
+    ring.sqarray = (unsigned*)(sq + p.sq_off.array);
+    ring.cqhead = (unsigned*)(cq + p.cq_off.head);
+    ring.cqtail = (unsigned*)(cq + p.cq_off.tail);
+    ring.cqmask = (unsigned*)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    ring.entries = p.sq_entries;
+    return 1;
+}
+
+static void ringfree() {
+    munmap(ring.sqes, ring.entries * sizeof(struct io_uring_sqe));
+    if (ring.cqring != ring.sqring) munmap(ring.cqring, ring.cqsize);
+    munmap(ring.sqring, ring.sqsize);
+    close(ring.fd);
+}
+
+/*
+ * Submit runs as one chain of linked writev requests and wait for all of
+ * them. A short or failed write cancels the rest of the chain, which is then
+ * finished with plain writev in order. When io_uring_enter keeps failing,
+ * the ring is given up: the runs it never took are written with writev, and
+ * the ones it took without completing are reported as failed.
+ */
+static void ringwrite(WriteRun* runs, int count, long* done) {
+    unsigned tail = *ring.sqtail;
+    for (int i = 0; i < count; i++) {
+        unsigned idx = tail & *ring.sqmask;
+        struct io_uring_sqe* sqe = &ring.sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = runs[i].fd;
+        sqe->off = (__u64)-1;
+        sqe->addr = (unsigned long)runs[i].iov;
+        sqe->len = runs[i].iovcnt;
+        sqe->flags = i + 1 < count ? IOSQE_IO_LINK : 0;
+        sqe->user_data = i;
+        ring.sqarray[idx] = idx;
+        tail++;
+    }
+    __atomic_store_n(ring.sqtail, tail, __ATOMIC_RELEASE);
+    int submit = count;
+    int reaped = 0;
+    int failures = 0;
+    for (int i = 0; i < count; i++) done[i] = LONG_MIN;
+    while (reaped < count) {
+        int ret = syscall(__NR_io_uring_enter, ring.fd, submit, count - reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno != EINTR && (submit == count || ++failures >= ENTER_RETRIES)) {
+            int err = errno;
+            useuring = 0;
+            /* Withdraw what was never submitted; the caller writes it with writev */
+            __atomic_store_n(ring.sqtail, tail - submit, __ATOMIC_RELEASE);
+            for (int i = 0; i < count; i++) {
+                if (i >= count - submit) {
+                    done[i] = 0;
+                } else if (done[i] == LONG_MIN) {
+                    writefailed(err);
+                    done[i] = runs[i].len;
+                }
+            }
+            return;
+        }
+        if (ret < 0 && errno != EINTR) sched_yield();
+        if (ret > 0) submit -= ret < submit ? ret : submit;
+        unsigned cqhead = *ring.cqhead;
+        while (cqhead != __atomic_load_n(ring.cqtail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &ring.cqes[cqhead & *ring.cqmask];
+            done[cqe->user_data] = cqe->res;
+            cqhead++;
+            reaped++;
+        }
+        __atomic_store_n(ring.cqhead, cqhead, __ATOMIC_RELEASE);
+    }
+}
+
+/* Run a batch of jobs in order */
+static void runjobs(WriteJob* jobs, int count) {
+    struct iovec* iov = malloc(count * sizeof(struct iovec));
+    WriteRun* runs = malloc(count * sizeof(WriteRun));
+    long* done = malloc(count * sizeof(long));
+    if (!iov || !runs || !done) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    int i = 0;
+    while (i < count) {
+        /* Group the writes up to the next close */
+        int nruns = 0;
+        int niov = 0;
+        while (i < count && jobs[i].data) {
+            WriteRun* run = nruns > 0 ? &runs[nruns - 1] : NULL;
+            if (!run || run->fd != jobs[i].fd || run->iovcnt == IOV_MAX) {
+                run = &runs[nruns++];
+                run->fd = jobs[i].fd;
+                run->iov = &iov[niov];
+                run->iovcnt = 0;
+                run->len = 0;
+            }
+            iov[niov].iov_base = jobs[i].data;
+            iov[niov].iov_len = jobs[i].len;
+            niov++;
+            run->iovcnt++;
+            run->len += jobs[i].len;
+            i++;
+        }
+        int r = 0;
+        while (r < nruns) {
+            int chunk = nruns - r;
+            for (int k = 0; k < chunk; k++) done[r + k] = 0;
+            if (useuring) {
+                if (chunk > (int)ring.entries) chunk = ring.entries;
+                ringwrite(&runs[r], chunk, &done[r]);
+            }
+            for (int k = r; k < r + chunk; k++) {
+                long n = done[k] > 0 ? done[k] : 0;
+                if ((size_t)n < runs[k].len) writeall(runs[k].fd, runs[k].iov, runs[k].iovcnt, n);
+            }
+            r += chunk;
+        }
+        for (int k = 0; k < niov; k++) free(iov[k].iov_base);
+        if (i < count) {
+            if (close(jobs[i].fd) != 0) writefailed(errno);
+            i++;
+        }
+    }
+    free(iov);
+    free(runs);
+    free(done);
+}
+
+static void* iothread(void* arg) {
+    (void)arg;
+    WriteJob* batch = malloc(depth * sizeof(WriteJob));
+    if (!batch) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    tracethread("io");
+    pthread_mutex_lock(&lock);
+    while (1) {
+        while (queued == 0 && !stopping) pthread_cond_wait(&notempty, &lock);
+        if (queued == 0) break;
+        int count = queued;
+        for (int i = 0; i < count; i++) batch[i] = queue[(head + i) % depth];
+        head = (head + count) % depth;
+        queued = 0;
+        busy = count;
+        pthread_cond_broadcast(&notfull);
+        pthread_mutex_unlock(&lock);
+        double traced = tracing() ? tracetime() : 0;
+        runjobs(batch, count);
+        if (traced) tracesampled("write", "io", traced, NULL, count);
+        pthread_mutex_lock(&lock);
+        busy = 0;
+        if (queued == 0) pthread_cond_broadcast(&idle);
+    }
+    pthread_mutex_unlock(&lock);
+    free(batch);
+    return NULL;
+}
+
+static void enqueue(int fd, char* data, size_t len) {
+    pthread_mutex_lock(&lock);
+    while (queued == depth) pthread_cond_wait(&notfull, &lock);
+    WriteJob* job = &queue[(head + queued) % depth];
+    job->fd = fd;
+    job->data = data;
+    job->len = len;
+    queued++;
+    pthread_cond_signal(&notempty);
+    pthread_mutex_unlock(&lock);
+}
+
+int startwriter(AsyncMode mode, int queuedepth) {
+    if (mode == ASYNC_OFF || running) return running;
+    depth = queuedepth > 0 ? queuedepth : 64;
+    queue = malloc(depth * sizeof(WriteJob));
+    if (!queue) return 0;
+    head = 0;
+    queued = 0;
+    busy = 0;
+    stopping = 0;
+    failed = 0;
+    useuring = ringopen = mode == ASYNC_AUTO && ringsetup(depth);
+    if (pthread_create(&thread, NULL, iothread, NULL) != 0) {
+        if (ringopen) ringfree();
+        ringopen = 0;
+        free(queue);
+        queue = NULL;
+        return 0;
+    }
+    running = 1;
+    return 1;
+}
+
+int writing() {
+    return running;
+}
+
+static ssize_t asyncwrite(void* cookie, const char* buf, size_t size) {
+    AsyncFile* file = cookie;
+    size_t left = size;
+    while (left > 0) {
+        if (!file->block) {
+            file->block = malloc(IO_BLOCK);
+            if (!file->block) return -1;
+            file->used = 0;
+        }
+        size_t n = IO_BLOCK - file->used;
+        if (n > left) n = left;
+        memcpy(file->block + file->used, buf, n);
+        file->used += n;
+        buf += n;
+        left -= n;
+        if (file->used == IO_BLOCK) {
+            enqueue(file->fd, file->block, file->used);
+            file->block = NULL;
+        }
+    }
+    return size;
+}
+
+static int asyncclose(void* cookie) {
+    AsyncFile* file = cookie;
+    if (file->block && file->used > 0) {
+        enqueue(file->fd, file->block, file->used);
+    } else {
+        free(file->block);
+    }
+    enqueue(file->fd, NULL, 0);
+    free(file);
+    return 0;
+}
+
+/* Open a file for "w" or "a" whose writes go through the I/O thread */
+FILE* asyncopen(const char* path, const char* mode) {
+    int flags = O_WRONLY | O_CREAT | (mode[0] == 'w' ? O_TRUNC : O_APPEND);
+    /* Queued writes to a file being truncated have to land first */
+    if (mode[0] == 'w') syncwriter();
+    int fd = open(path, flags, 0644);
+    if (fd < 0) return NULL;
+    AsyncFile* file = calloc(1, sizeof(AsyncFile));
+    if (!file) {
+        close(fd);
+        return NULL;
+    }
+    file->fd = fd;
+    cookie_io_functions_t io = { NULL, asyncwrite, NULL, asyncclose };
+    FILE* fp = fopencookie(file, mode, io);
+    if (!fp) {
+        close(fd);
+        free(file);
+    }
+    return fp;
+}
+
+/* Wait until every queued job is done */
+void syncwriter() {
+    if (!running) return;
+    pthread_mutex_lock(&lock);
+    while (queued > 0 || busy > 0) pthread_cond_wait(&idle, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+/* Wait for the queued writes and stop the I/O thread; returns 0 when a write failed */
+int stopwriter() {
+    if (!running) return 1;
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_signal(&notempty);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    if (ringopen) ringfree();
+    ringopen = 0;
+    free(queue);
+    queue = NULL;
+    running = 0;
+    return !failed;
+}
@@ -0,0 +1,28 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdio.h>
+
+/*
+ * Asynchronous CSV output (--async-io). Files opened with asyncopen() are
+ * stdio streams whose data is collected into blocks and handed to an I/O
+ * thread through a queue of --io-depth blocks; the writer waits when the
+ * queue is full. The I/O thread gathers consecutive blocks of the same file
+ * into one writev, submitted as linked io_uring writes when the kernel
+ * supports it. Jobs complete in queue order, so a file that is closed and
+ * reopened for appending keeps its rows in order.
+ */
+
+typedef enum {
+    ASYNC_OFF,
+    ASYNC_AUTO,     /* io_uring when available, writev otherwise */
+    ASYNC_WRITEV
+} AsyncMode;
+
+int startwriter(AsyncMode mode, int depth);
+int writing();
+FILE* asyncopen(const char* path, const char* mode);
+void syncwriter();
+int stopwriter();
+
+#endif